@@ -0,0 +1,101 @@
+#ifndef ALIAS_TABLE_H
+#define ALIAS_TABLE_H
+
+#include <assert.h>
+#include <random>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Walker/Vose alias table: O(n) construction, O(1) sampling from a fixed
+// discrete distribution. Zero-weight outcomes are dropped, so sparse rows
+// only cost their non-zero entries.
+
+class ALIAS_TABLE
+{
+public:
+
+    ALIAS_TABLE() { }
+
+    // Outcome i has weight weights[i]
+    void Build(const std::vector<double>& weights)
+    {
+        std::vector<int> outcomes(weights.size());
+        for (int i = 0; i < (int) weights.size(); ++i)
+            outcomes[i] = i;
+        Build(outcomes, weights);
+    }
+
+    // Outcome outcomes[i] has weight weights[i]
+    void Build(const std::vector<int>& outcomes, const std::vector<double>& weights)
+    {
+        assert(outcomes.size() == weights.size());
+        Outcome.clear();
+        std::vector<double> w;
+        double total = 0.0;
+        for (int i = 0; i < (int) weights.size(); ++i)
+        {
+            if (weights[i] > 0)
+            {
+                Outcome.push_back(outcomes[i]);
+                w.push_back(weights[i]);
+                total += weights[i];
+            }
+        }
+
+        int n = Outcome.size();
+        Prob.assign(n, 1.0);
+        Alias.resize(n);
+        for (int i = 0; i < n; ++i)
+            Alias[i] = i;
+        if (n == 0)
+            return;
+
+        std::vector<int> small, large;
+        for (int i = 0; i < n; ++i)
+        {
+            w[i] *= n / total;
+            if (w[i] < 1.0)
+                small.push_back(i);
+            else
+                large.push_back(i);
+        }
+
+        while (!small.empty() && !large.empty())
+        {
+            int s = small.back(), l = large.back();
+            small.pop_back();
+            Prob[s] = w[s];
+            Alias[s] = l;
+            w[l] = (w[l] + w[s]) - 1.0;
+            if (w[l] < 1.0)
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // Remaining entries are 1 up to rounding error
+    }
+
+    template<class RNG>
+    int Sample(RNG& rng) const
+    {
+        assert(!Empty());
+        std::uniform_real_distribution<double> unif(0.0, 1.0);
+        double u = unif(rng) * Prob.size();
+        int i = static_cast<int>(u);
+        if (i >= (int) Prob.size())
+            i = Prob.size() - 1;
+        return Outcome[(u - i) < Prob[i] ? i : Alias[i]];
+    }
+
+    bool Empty() const { return Outcome.empty(); }
+    int Size() const { return Outcome.size(); }
+
+private:
+
+    std::vector<double> Prob;
+    std::vector<int> Alias;
+    std::vector<int> Outcome;
+};
+
+#endif // ALIAS_TABLE_H
@@ -0,0 +1,124 @@
+#ifndef AMAF_H
+#define AMAF_H
+
+#include "history.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// All-moves-as-first weights of one simulation. The weight of an action at
+// a node sums RaveDiscount^k over its occurrences k steps after the node,
+// or only over the first one. The nodes of the path are backed up deepest
+// first, so the weights are computed once at the deepest node and then
+// stepped up one level at a time, each in O(actions) instead of rescanning
+// the history.
+
+class AMAF_WEIGHTS
+{
+public:
+
+    void Reset(int numActions, bool firstOccurrence)
+    {
+        Weights.assign(numActions, 0.0);
+        FirstOccurrence = firstOccurrence;
+        Position = -1;
+    }
+
+    // Weights for the node whose next step is history[position]
+    const std::vector<double>& At(const HISTORY& history, int position,
+        double discount)
+    {
+        if (Position < 0)
+        {
+            double totalDiscount = 1.0;
+            for (int t = position; t < history.Size(); ++t)
+            {
+                double& weight = Weights[history[t].Action];
+                if (!FirstOccurrence)
+                    weight += totalDiscount;
+                else if (weight == 0)
+                    weight = totalDiscount;
+                totalDiscount *= discount;
+            }
+            Position = position;
+        }
+
+        assert(position <= Position);
+        while (Position > position)
+        {
+            Position--;
+            for (double& weight : Weights)
+                weight *= discount;
+            double& weight = Weights[history[Position].Action];
+            weight = FirstOccurrence ? 1.0 : weight + 1.0;
+        }
+        return Weights;
+    }
+
+    static void UnitTest();
+
+private:
+
+    std::vector<double> Weights;
+    bool FirstOccurrence;
+    int Position;
+
+    static void Rescan(const HISTORY& history, int position, double discount,
+        bool firstOccurrence, std::vector<double>& weights);
+};
+
+// Weights from a rescan of the history, as At computed them before
+inline void AMAF_WEIGHTS::Rescan(const HISTORY& history, int position,
+    double discount, bool firstOccurrence, std::vector<double>& weights)
+{
+    std::vector<bool> seen(weights.size(), false);
+    std::fill(weights.begin(), weights.end(), 0.0);
+    double totalDiscount = 1.0;
+    for (int t = position; t < history.Size(); ++t)
+    {
+        int a = history[t].Action;
+        if (!firstOccurrence || !seen[a])
+            weights[a] += totalDiscount;
+        seen[a] = true;
+        totalDiscount *= discount;
+    }
+}
+
+inline void AMAF_WEIGHTS::UnitTest()
+{
+    const int numActions = 5;
+    std::vector<double> expected(numActions);
+    for (bool firstOccurrence : { false, true })
+    {
+        for (double discount : { 0.0, 0.5, 0.95, 1.0 })
+        {
+            for (int i = 0; i < 100; ++i)
+            {
+                HISTORY history;
+                int length = 1 + rand() % 30;
+                for (int t = 0; t < length; ++t)
+                    history.Add(rand() % numActions, 0);
+
+                // Backed up deepest first, sometimes skipping levels
+                AMAF_WEIGHTS amaf;
+                amaf.Reset(numActions, firstOccurrence);
+                for (int position = length - 1; position >= 0;
+                    position -= 1 + (rand() % 4 == 0))
+                {
+                    const std::vector<double>& weights =
+                        amaf.At(history, position, discount);
+                    Rescan(history, position, discount,
+                        firstOccurrence, expected);
+                    for (int a = 0; a < numActions; ++a)
+                        assert(std::abs(weights[a] - expected[a]) < 1e-9);
+                    (void) weights;
+                }
+            }
+        }
+    }
+}
+
+#endif // AMAF_H
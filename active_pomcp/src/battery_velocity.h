@@ -28,11 +28,11 @@ public:
                 j = 0;
     }
 
-    virtual void update(STATE *s) {
+    virtual void update(STATE *s, int count) {
         const BATTERY_VELOCITY_STATE& state = safe_cast<const BATTERY_VELOCITY_STATE&>(*s);
-        total++;
+        total += count;
         for (int i = 0; i < 8; i++) {  // For each segment difficulty
-            distr[i][state.segDifficulties[i]] += 1;
+            distr[i][state.segDifficulties[i]] += count;
         }
     }
 
@@ -1,15 +1,28 @@
 #include "beliefstate.h"
 #include "simulator.h"
 #include "simulator_lazy.h"
+#include "testsimulator.h"
 #include "utils.h"
+#include <algorithm>
 
 using namespace UTILS;
 
-BELIEF_STATE::BELIEF_STATE(): metainfo(nullptr)
+BELIEF_STATE::BELIEF_STATE(): TotalCount(0), Offered(0), Unique(nullptr), metainfo(nullptr),
+    Prototype(nullptr), MetaDirty(false)
 {
     Samples.clear();
 }
 
+void BELIEF_STATE::ClearSamples()
+{
+    Samples.clear();
+    Counts.clear();
+    Cumulative.clear();
+    Index.clear();
+    TotalCount = 0;
+    Offered = 0;
+}
+
 void BELIEF_STATE::Free(const SIMULATOR& simulator)
 {
     for (std::vector<STATE*>::iterator i_state = Samples.begin();
@@ -17,12 +30,14 @@ void BELIEF_STATE::Free(const SIMULATOR& simulator)
     {
         simulator.FreeState(*i_state);
     }
-    Samples.clear();
+    ClearSamples();
 
     if (metainfo) {
         simulator.FreeMetainfo(metainfo);
         metainfo = nullptr;
     }
+    Prototype = nullptr;
+    MetaDirty = false;
 }
 
 void BELIEF_STATE::Free(const SIMULATOR_LAZY& simulator)
@@ -32,71 +47,189 @@ void BELIEF_STATE::Free(const SIMULATOR_LAZY& simulator)
     {
         simulator.FreeState(*i_state);
     }
-    Samples.clear();
+    ClearSamples();
 
     if (metainfo) {
         simulator.FreeMetainfo(metainfo);
         metainfo = nullptr;
     }
+    Prototype = nullptr;
+    MetaDirty = false;
+}
+
+int BELIEF_STATE::SampleIndex() const
+{
+    // Plain particles all have count one
+    if (TotalCount == (int) Samples.size())
+        return Random(Samples.size());
+    return ParticleIndex(Random(TotalCount));
+}
+
+int BELIEF_STATE::ParticleIndex(int particle) const
+{
+    if (TotalCount == (int) Samples.size())
+        return particle;
+
+    if (Cumulative.size() != Counts.size())
+    {
+        Cumulative.resize(Counts.size());
+        int total = 0;
+        for (int i = 0; i < (int) Counts.size(); ++i)
+        {
+            total += Counts[i];
+            Cumulative[i] = total;
+        }
+    }
+    return std::upper_bound(Cumulative.begin(), Cumulative.end(), particle)
+        - Cumulative.begin();
 }
 
 STATE* BELIEF_STATE::CreateSample(const SIMULATOR& simulator) const
 {
-    int index = Random(Samples.size());
+    int index = SampleIndex();
     return simulator.Copy(*Samples[index]);
 }
 
 STATE* BELIEF_STATE::CreateSample(const SIMULATOR_LAZY& simulator) const
 {
-    int index = Random(Samples.size());
+    int index = SampleIndex();
     return simulator.Copy(*Samples[index]);
 }
 
-void BELIEF_STATE::AddSample(STATE* state)
+void BELIEF_STATE::EnableDeduplication(const SIMULATOR& simulator)
 {
+    if (!simulator.HasStateHash())
+        return;
+    assert(Samples.empty());
+    Unique = &simulator;
+}
+
+bool BELIEF_STATE::AddCount(const STATE& state, int count)
+{
+    if (!Unique)
+        return false;
+
+    auto range = Index.equal_range(Unique->StateHash(state));
+    for (auto i_index = range.first; i_index != range.second; ++i_index)
+    {
+        int i = i_index->second;
+        if (Unique->StateEquals(*Samples[i], state))
+        {
+            Counts[i] += count;
+            TotalCount += count;
+            Cumulative.clear();
+            MetaDirty = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void BELIEF_STATE::RemoveParticle(int particle, const SIMULATOR& simulator)
+{
+    int i = ParticleIndex(particle);
+    TotalCount--;
+    Cumulative.clear();
+    MetaDirty = true;
+    if (--Counts[i] > 0)
+        return;
+
+    // Swap the last state into the freed slot
+    int last = Samples.size() - 1;
+    if (Unique)
+    {
+        auto range = Index.equal_range(Unique->StateHash(*Samples[i]));
+        for (auto i_index = range.first; i_index != range.second; ++i_index)
+        {
+            if (i_index->second == i)
+            {
+                Index.erase(i_index);
+                break;
+            }
+        }
+        if (i != last)
+        {
+            range = Index.equal_range(Unique->StateHash(*Samples[last]));
+            for (auto i_index = range.first; i_index != range.second; ++i_index)
+                if (i_index->second == last)
+                    i_index->second = i;
+        }
+    }
+    simulator.FreeState(Samples[i]);
+    Samples[i] = Samples[last];
+    Counts[i] = Counts[last];
+    Samples.pop_back();
+    Counts.pop_back();
+}
+
+void BELIEF_STATE::AddSample(STATE* state, int count)
+{
+    if (Unique)
+    {
+        if (AddCount(*state, count))
+        {
+            Unique->FreeState(state);
+            return;
+        }
+        Index.emplace(Unique->StateHash(*state), Samples.size());
+    }
+
     Samples.push_back(state);
-    if (metainfo)
-        metainfo->update(state);
+    Counts.push_back(count);
+    TotalCount += count;
+    Cumulative.clear();
+    MetaDirty = true;
 }
 
-void BELIEF_STATE::Copy(const BELIEF_STATE& beliefs, const SIMULATOR& simulator)
+void BELIEF_STATE::RefreshMetainfo() const
 {
-    for (std::vector<STATE*>::const_iterator i_state = beliefs.Samples.begin();
-        i_state != beliefs.Samples.end(); ++i_state)
+    if (!metainfo && Prototype)
+        metainfo = Prototype->clone();
+    if (metainfo && MetaDirty)
     {
-        AddSample(simulator.Copy(**i_state));
+        metainfo->clear();
+        metainfo->update_all(Samples, Counts);
     }
+    MetaDirty = false;
+}
+
+void BELIEF_STATE::Copy(const BELIEF_STATE& beliefs, const SIMULATOR& simulator)
+{
+    if (!Unique)
+        Unique = beliefs.Unique;
+
+    for (int i = 0; i < (int) beliefs.Samples.size(); ++i)
+        AddSample(simulator.Copy(*beliefs.Samples[i]), beliefs.Counts[i]);
 
     // delete previous
     if (metainfo) {
         simulator.FreeMetainfo(metainfo);
         metainfo = nullptr;
     }
-    // copy new, if any
+    // copy new, if any, to be refreshed from our samples on demand
     if (beliefs.metainfo)
-        metainfo = beliefs.get_metainfo().clone();
-    else
-        metainfo = nullptr;
+        metainfo = beliefs.metainfo->clone();
+    if (!Prototype)
+        Prototype = beliefs.Prototype;
+    MetaDirty = true;
 }
 
 void BELIEF_STATE::Copy(const BELIEF_STATE& beliefs, const SIMULATOR_LAZY& simulator)
 {
-    for (std::vector<STATE*>::const_iterator i_state = beliefs.Samples.begin();
-        i_state != beliefs.Samples.end(); ++i_state)
-    {
-        AddSample(simulator.Copy(**i_state));
-    }
+    for (int i = 0; i < (int) beliefs.Samples.size(); ++i)
+        AddSample(simulator.Copy(*beliefs.Samples[i]), beliefs.Counts[i]);
 
     // delete previous
     if (metainfo) {
         simulator.FreeMetainfo(metainfo);
         metainfo = nullptr;
     }
-    // copy new, if any
+    // copy new, if any, to be refreshed from our samples on demand
     if (beliefs.metainfo)
-        metainfo = beliefs.get_metainfo().clone();
-    else
-        metainfo = nullptr;
+        metainfo = beliefs.metainfo->clone();
+    if (!Prototype)
+        Prototype = beliefs.Prototype;
+    MetaDirty = true;
 }
 
 void BELIEF_STATE::set_metainfo(const BELIEF_META_INFO &m, const SIMULATOR& simulator) {
@@ -105,6 +238,7 @@ void BELIEF_STATE::set_metainfo(const BELIEF_META_INFO &m, const SIMULATOR& simu
         metainfo = nullptr;
     }
     metainfo = m.clone();
+    MetaDirty = false;
 }
 
 void BELIEF_STATE::set_metainfo(const BELIEF_META_INFO &m, const SIMULATOR_LAZY& simulator) {
@@ -113,18 +247,120 @@ void BELIEF_STATE::set_metainfo(const BELIEF_META_INFO &m, const SIMULATOR_LAZY&
         metainfo = nullptr;
     }
     metainfo = m.clone();
+    MetaDirty = false;
+}
+
+void BELIEF_STATE::set_metainfo_prototype(const BELIEF_META_INFO *prototype) {
+    Prototype = prototype;
+    MetaDirty = !Samples.empty();
 }
 
 void BELIEF_STATE::Move(BELIEF_STATE& beliefs)
 {
-    for (std::vector<STATE*>::const_iterator i_state = beliefs.Samples.begin();
-        i_state != beliefs.Samples.end(); ++i_state)
-    {
-        AddSample(*i_state);
+    for (int i = 0; i < (int) beliefs.Samples.size(); ++i)
+        AddSample(beliefs.Samples[i], beliefs.Counts[i]);
+    beliefs.ClearSamples();
+
+    // keep our own metainfo when the source has none, either way it is
+    // refreshed from the moved samples on demand
+    if (beliefs.metainfo) {
+        delete metainfo;
+        metainfo = beliefs.metainfo;
+        beliefs.metainfo = nullptr;
     }
-    beliefs.Samples.clear();
+    if (!Prototype)
+        Prototype = beliefs.Prototype;
+    beliefs.Prototype = nullptr;
+    beliefs.MetaDirty = false;
+}
+
+static STATE* CreateTestState(const TEST_SIMULATOR& simulator, int depth)
+{
+    TEST_STATE* state = safe_cast<TEST_STATE*>(simulator.CreateStartState());
+    state->Depth = depth;
+    return state;
+}
 
-    metainfo = beliefs.metainfo;
-    beliefs.metainfo = nullptr;
+// Particles per depth, from the stored states and their counts
+[[maybe_unused]] static std::vector<int> TestCounts(const BELIEF_STATE& beliefs, int maxDepth)
+{
+    std::vector<int> counts(maxDepth, 0);
+    for (int i = 0; i < beliefs.GetNumSamples(); ++i)
+        counts[safe_cast<const TEST_STATE*>(beliefs.GetSample(i))->Depth]
+            += beliefs.GetCount(i);
+    return counts;
 }
 
+void BELIEF_STATE::UnitTest()
+{
+    TEST_SIMULATOR simulator(2, 2, 0);
+    const int numDepths = 7;
+
+    for (bool deduplicate : { false, true })
+    {
+        BELIEF_STATE beliefs;
+        if (deduplicate)
+            beliefs.EnableDeduplication(simulator);
+        assert(beliefs.Deduplicated() == deduplicate);
+
+        // Duplicates, with counts
+        std::vector<int> expected(numDepths, 0);
+        for (int i = 0; i < 100; ++i)
+        {
+            int depth = i % numDepths, count = 1 + i % 3;
+            beliefs.AddSample(CreateTestState(simulator, depth), count);
+            expected[depth] += count;
+        }
+        assert(beliefs.GetTotalCount() == 100 + 99);
+        assert(beliefs.GetNumSamples() == (deduplicate ? numDepths : 100));
+        assert(TestCounts(beliefs, numDepths) == expected);
+
+        STATE* state = CreateTestState(simulator, 3);
+        assert(beliefs.AddCount(*state, 5) == deduplicate);
+        if (deduplicate)
+            expected[3] += 5;
+        simulator.FreeState(state);
+        state = CreateTestState(simulator, numDepths);
+        assert(!beliefs.AddCount(*state));
+        simulator.FreeState(state);
+
+        // Each particle maps to its state, after the counts changed
+        std::vector<int> particles(beliefs.GetNumSamples(), 0);
+        for (int p = 0; p < beliefs.GetTotalCount(); ++p)
+            particles[beliefs.ParticleIndex(p)]++;
+        for (int i = 0; i < beliefs.GetNumSamples(); ++i)
+            assert(particles[i] == beliefs.GetCount(i));
+
+        // Removal down to empty, two particles at a time; the index follows
+        // the swapped states, so a count added in between goes to the
+        // right state
+        while (!beliefs.Empty())
+        {
+            for (int r = 0; r < 2 && !beliefs.Empty(); ++r)
+            {
+                int particle = Random(beliefs.GetTotalCount());
+                int depth = safe_cast<const TEST_STATE*>(
+                    beliefs.GetSample(beliefs.ParticleIndex(particle)))->Depth;
+                int total = beliefs.GetTotalCount();
+                beliefs.RemoveParticle(particle, simulator);
+                expected[depth]--;
+                assert(beliefs.GetTotalCount() == total - 1);
+                (void) total;
+                assert(TestCounts(beliefs, numDepths) == expected);
+            }
+            if (deduplicate)
+            {
+                int depth = Random(numDepths);
+                state = CreateTestState(simulator, depth);
+                bool found = beliefs.AddCount(*state);
+                assert(found == (expected[depth] > 0));
+                if (found)
+                    expected[depth]++;
+                simulator.FreeState(state);
+                assert(TestCounts(beliefs, numDepths) == expected);
+            }
+        }
+        assert(beliefs.GetTotalCount() == 0);
+        beliefs.Free(simulator);
+    }
+}
@@ -1,6 +1,8 @@
 #ifndef BELIEF_STATE_H
 #define BELIEF_STATE_H
 
+#include <cstddef>
+#include <unordered_map>
 #include <vector>
 
 class STATE;
@@ -9,11 +11,22 @@ class SIMULATOR_LAZY;
 
 class BELIEF_META_INFO {
 public:
-    virtual void update(STATE *) {}
+    virtual ~BELIEF_META_INFO() {}
+    // count: number of particles the state stands for
+    virtual void update(STATE *, int count) {}
+    // Aggregate a whole particle set at once, after clear()
+    virtual void update_all(const std::vector<STATE *> &states,
+                            const std::vector<int> &counts) {
+        for (std::size_t i = 0; i < states.size(); i++)
+            update(states[i], counts[i]);
+    }
     virtual void clear() {}
     virtual BELIEF_META_INFO *clone() const {
         return nullptr;
     }
+    // Mean entropy of the belief marginals, scaled to [0, 1],
+    // negative if the domain does not provide it
+    virtual double entropy() const { return -1; }
 };
 
 class BELIEF_STATE
@@ -31,8 +44,24 @@ public:
     STATE* CreateSample(const SIMULATOR& simulator) const;
     STATE* CreateSample(const SIMULATOR_LAZY& simulator) const;
 
-    // Added state is owned by belief state
-    void AddSample(STATE* state);
+    // Added state is owned by belief state, and stands for count particles
+    void AddSample(STATE* state, int count = 1);
+
+    // Store each distinct state once with a particle count, using the
+    // simulator's state hash (no effect if the simulator has none)
+    void EnableDeduplication(const SIMULATOR& simulator);
+    bool Deduplicated() const { return Unique != nullptr; }
+
+    // If an equal state is already stored, add count to it and return true
+    bool AddCount(const STATE& state, int count = 1);
+
+    // Remove one particle (0 <= particle < GetTotalCount()), freeing its
+    // state when no particle is left for it
+    void RemoveParticle(int particle, const SIMULATOR& simulator);
+
+    // Count a sample offered to this belief, kept or not (for reservoir
+    // sampling), and return the number offered so far
+    int Offer() { return ++Offered; }
 
     // Make own copies of all samples
     void Copy(const BELIEF_STATE& beliefs, const SIMULATOR& simulator);
@@ -42,24 +71,56 @@ public:
     void Move(BELIEF_STATE& beliefs);
 
     bool Empty() const { return Samples.empty(); }
+    // Number of stored (distinct, when deduplicated) states
     int GetNumSamples() const { return Samples.size(); }
     const STATE* GetSample(int index) const { return Samples[index]; }
+    // Particles represented by a stored state, and in total
+    int GetCount(int index) const { return Counts[index]; }
+    int GetTotalCount() const { return TotalCount; }
 
+    // The metainfo is aggregated from the samples on first query and
+    // cached until the samples change
     BELIEF_META_INFO &get_metainfo() {
+        RefreshMetainfo();
         return *metainfo;
     }
 
     const BELIEF_META_INFO &get_metainfo() const {
+        RefreshMetainfo();
         return *metainfo;
     }
 
+    bool has_metainfo() const { return metainfo || Prototype; }
+
+    // Install a copy of m, valid until the next sample is added
     void set_metainfo(const BELIEF_META_INFO &m, const SIMULATOR& simulator);
     void set_metainfo(const BELIEF_META_INFO &m, const SIMULATOR_LAZY& simulator);
 
+    // Clone the (caller owned) prototype only when first queried
+    void set_metainfo_prototype(const BELIEF_META_INFO *prototype);
+
+    static void UnitTest();
+
 private:
 
+    int SampleIndex() const;
+    int ParticleIndex(int particle) const;
+    void ClearSamples();
+    void RefreshMetainfo() const;
+
     std::vector<STATE*> Samples;
-    BELIEF_META_INFO *metainfo;
+    std::vector<int> Counts;
+    int TotalCount;
+    int Offered;
+    // Cumulative counts, rebuilt lazily for sampling proportional to count
+    mutable std::vector<int> Cumulative;
+
+    const SIMULATOR* Unique;
+    std::unordered_multimap<std::size_t, int> Index;
+
+    mutable BELIEF_META_INFO *metainfo;
+    const BELIEF_META_INFO *Prototype;
+    mutable bool MetaDirty;
 };
 
 #endif // BELIEF_STATE_H
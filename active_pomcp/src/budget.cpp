@@ -0,0 +1,66 @@
+#include "budget.h"
+
+using namespace std;
+using namespace UTILS;
+
+BUDGET::PARAMS::PARAMS()
+:   Mode(UNIFORM),
+    EpisodeSteps(20),
+    MinScale(0.25),
+    MaxScale(2.0)
+{
+}
+
+BUDGET::BUDGET(const PARAMS& params)
+:   Params(params),
+    NumSimulations(0),
+    Remaining(0),
+    Step(0)
+{
+}
+
+void BUDGET::StartEpisode(int numSimulations)
+{
+    NumSimulations = numSimulations;
+    Remaining = numSimulations * Params.EpisodeSteps;
+    Step = 0;
+}
+
+int BUDGET::NextBudget(const MCTS& mcts, const SIMULATOR& simulator)
+{
+    if (!Enabled())
+        return NumSimulations;
+
+    // Past the expected length every step gets the minimum
+    int stepsLeft = Params.EpisodeSteps - Step;
+    double share = stepsLeft > 0 ? max(0, Remaining) / (double) stepsLeft : 0;
+    double uncertainty = Uncertainty(mcts, simulator);
+    double scale = uncertainty < 0 ? 1.0 : Params.MinScale
+        + (Params.MaxScale - Params.MinScale) * uncertainty;
+    int budget = max(1, max((int) (share * scale),
+        (int) (NumSimulations * Params.MinScale)));
+
+    Remaining -= budget;
+    Step++;
+    StepBudgets.Add(budget);
+    return budget;
+}
+
+double BUDGET::Uncertainty(const MCTS& mcts, const SIMULATOR& simulator) const
+{
+    const BELIEF_STATE& beliefs = mcts.BeliefState();
+    if (Params.Mode == ENTROPY && beliefs.has_metainfo())
+    {
+        double entropy = beliefs.get_metainfo().entropy();
+        if (entropy >= 0)
+            return entropy;
+    }
+
+    // Gap between the two best actions of the subtree the last update
+    // stepped into, valued by the search before it, relative to the reward
+    // range. Without one the decision takes its even share.
+    double gap = mcts.GetRootGap();
+    if (gap < 0)
+        return -1;
+    return max(0.0, 1.0 - gap / simulator.GetRewardRange());
+}
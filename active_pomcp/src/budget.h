@@ -0,0 +1,60 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include "mcts.h"
+#include "simulator.h"
+#include "statistic.h"
+
+//----------------------------------------------------------------------------
+// Episode level simulation budget. An episode gets NumSimulations for each
+// of the decisions it is expected to take. Each decision takes an even share
+// of what is left, scaled up when the root is uncertain and down when the
+// decision looks easy, so easy steps leave simulations to the hard ones.
+
+class BUDGET
+{
+public:
+
+    enum
+    {
+        UNIFORM,    // NumSimulations at every step
+        ENTROPY,    // entropy of the belief marginals (value gap if missing)
+        VALUE_GAP   // gap between the two best root actions
+    };
+
+    struct PARAMS
+    {
+        PARAMS();
+
+        int Mode;
+        int EpisodeSteps;
+        // Share scale from an easy to an uncertain decision. MinScale
+        // also floors every step at MinScale * NumSimulations, so steps
+        // past EpisodeSteps still search
+        double MinScale, MaxScale;
+    };
+
+    BUDGET(const PARAMS& params);
+
+    bool Enabled() const { return Params.Mode != UNIFORM; }
+    void StartEpisode(int numSimulations);
+    // Simulations for the next decision of mcts
+    int NextBudget(const MCTS& mcts, const SIMULATOR& simulator);
+    const STATISTIC& GetStepBudgets() const { return StepBudgets; }
+    void ClearStatistics() { StepBudgets.Clear(); }
+
+private:
+
+    // From 0 for an easy decision to 1 for an uncertain one, -1 unknown
+    double Uncertainty(const MCTS& mcts, const SIMULATOR& simulator) const;
+
+    PARAMS Params;
+    int NumSimulations;
+    int Remaining;
+    int Step;
+    STATISTIC StepBudgets;
+};
+
+//----------------------------------------------------------------------------
+
+#endif // BUDGET_H
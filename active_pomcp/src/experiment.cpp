@@ -41,6 +41,7 @@ void EXPERIMENT::Run()
     Timer timer;
 
     MCTS mcts(Simulator, SearchParams);
+    mcts.SetRolloutSimulator(RolloutSimulator);
 
     double undiscountedReturn = 0.0;
     double discountedReturn = 0.0;
@@ -58,6 +59,7 @@ void EXPERIMENT::Run()
     if (SearchParams.Verbose >= 1)
         Real.DisplayState(*state, cout);
 
+    Budget.StartEpisode(SearchParams.NumSimulations);
     for (t = 0; t < ExpParams.NumSteps; t++)
     {
         if (XES::enabled())
@@ -70,6 +72,16 @@ void EXPERIMENT::Run()
             Simulator.log_beliefs(mcts.BeliefState());
         }
 
+        if (Budget.Enabled())
+        {
+            int budget = Budget.NextBudget(mcts, Simulator);
+            mcts.SetNumSimulations(budget);
+            if (SearchParams.Verbose >= 1)
+                cout << "Step budget = " << budget << " simulations" << endl;
+            if (XES::enabled())
+                XES::logger().add_attributes({{"simulations", budget}});
+        }
+
         int action = mcts.SelectAction();
 
         terminal = Real.Step(*state, action, observation, reward);
@@ -198,9 +210,7 @@ void EXPERIMENT::DiscountedReturn()
     cout << "Main runs" << endl;
     OutputFile << "Simulations\tRuns\tUndiscounted return\tUndiscounted error\tDiscounted return\tDiscounted error\tTime\n";
 
-    SearchParams.MaxDepth = Simulator.GetHorizon(ExpParams.Accuracy, ExpParams.UndiscountedHorizon);
-    ExpParams.SimSteps = Simulator.GetHorizon(ExpParams.Accuracy, ExpParams.UndiscountedHorizon);
-    ExpParams.NumSteps = Real.GetHorizon(ExpParams.Accuracy, ExpParams.UndiscountedHorizon);
+    SetHorizons();
 
     if (XES::enabled()) {
         XES::logger().add_attributes({
@@ -213,53 +223,114 @@ void EXPERIMENT::DiscountedReturn()
     }
 
     for (int i = ExpParams.MinDoubles; i <= ExpParams.MaxDoubles; i++)
-    {
-        if (use_fixed_seed) {
-            UTILS::RandomSeed(fixed_seed);
-            Simulator.set_seed(fixed_seed);
-            real_seed = fixed_seed + 1;
-        }
+        RunDoubles(i);
+}
 
-        SearchParams.NumSimulations = 1 << i;
-        SearchParams.NumStartStates = 1 << i;
-        if (i + ExpParams.TransformDoubles >= 0)
-            SearchParams.NumTransforms = 1 << (i + ExpParams.TransformDoubles);
-        else
-            SearchParams.NumTransforms = 1;
-        SearchParams.MaxAttempts = SearchParams.NumTransforms * ExpParams.TransformAttempts;
+void EXPERIMENT::SetHorizons()
+{
+    SearchParams.MaxDepth = Simulator.GetHorizon(ExpParams.Accuracy, ExpParams.UndiscountedHorizon);
+    ExpParams.SimSteps = Simulator.GetHorizon(ExpParams.Accuracy, ExpParams.UndiscountedHorizon);
+    ExpParams.NumSteps = Real.GetHorizon(ExpParams.Accuracy, ExpParams.UndiscountedHorizon);
+}
 
-        Results.Clear();
-        MultiRun();
+void EXPERIMENT::RunDoubles(int i, const string& label)
+{
+    if (use_fixed_seed) {
+        UTILS::RandomSeed(fixed_seed);
+        Simulator.set_seed(fixed_seed);
+        real_seed = fixed_seed + 1;
+    }
 
-        if (XES::enabled()) {
-            XES::logger().add_attributes(
-                    {{"average undiscounted return",
-                    Results.UndiscountedReturn.GetMean()},
-                    {"average undiscounted return std",
-                    Results.UndiscountedReturn.GetStdErr()},
-                    {"average discounted return", Results.DiscountedReturn.GetMean()},
-                    {"average discounted return std",
-                    Results.DiscountedReturn.GetStdErr()},
-                    {"average time", Results.Time.GetMean()},
-                    {"average time std", Results.Time.GetStdDev()},
-                    {"total time", Results.Time.GetTotal()}
-                    });
+    SearchParams.NumSimulations = 1 << i;
+    SearchParams.NumStartStates = 1 << i;
+    if (i + ExpParams.TransformDoubles >= 0)
+        SearchParams.NumTransforms = 1 << (i + ExpParams.TransformDoubles);
+    else
+        SearchParams.NumTransforms = 1;
+    SearchParams.MaxAttempts = SearchParams.NumTransforms * ExpParams.TransformAttempts;
+
+    Results.Clear();
+    Budget.ClearStatistics();
+    MultiRun();
+
+    if (XES::enabled()) {
+        XES::logger().add_attributes(
+                {{"average undiscounted return",
+                Results.UndiscountedReturn.GetMean()},
+                {"average undiscounted return std",
+                Results.UndiscountedReturn.GetStdErr()},
+                {"average discounted return", Results.DiscountedReturn.GetMean()},
+                {"average discounted return std",
+                Results.DiscountedReturn.GetStdErr()},
+                {"average time", Results.Time.GetMean()},
+                {"average time std", Results.Time.GetStdDev()},
+                {"total time", Results.Time.GetTotal()}
+                });
+    }
+
+    cout << "Simulations = " << SearchParams.NumSimulations << endl
+        << "Runs = " << Results.Time.GetCount() << endl
+        << "Undiscounted return = " << Results.UndiscountedReturn.GetMean()
+        << " +- " << Results.UndiscountedReturn.GetStdErr() << endl
+        << "Discounted return = " << Results.DiscountedReturn.GetMean()
+        << " +- " << Results.DiscountedReturn.GetStdErr() << endl
+        << "Time = " << Results.Time.GetMean() << endl;
+    if (Budget.Enabled())
+        Budget.GetStepBudgets().Print("Simulations per step", cout);
+    if (!label.empty())
+        OutputFile << label << "\t";
+    OutputFile << SearchParams.NumSimulations << "\t"
+        << Results.Time.GetCount() << "\t"
+        << Results.UndiscountedReturn.GetMean() << "\t"
+        << Results.UndiscountedReturn.GetStdErr() << "\t"
+        << Results.DiscountedReturn.GetMean() << "\t"
+        << Results.DiscountedReturn.GetStdErr() << "\t"
+        << Results.Time.GetMean() << endl;
+}
+
+void EXPERIMENT::CompareSelection()
+{
+    static const char* names[] = { "UCB1", "UCB-V", "Thompson" };
+    const int numRules = MCTS::SELECT_THOMPSON + 1;
+    int selectionRule = SearchParams.SelectionRule;
+
+    cout << "Selection rule comparison" << endl;
+    OutputFile << "Selection\tSimulations\tRuns\tUndiscounted return\tUndiscounted error\tDiscounted return\tDiscounted error\tTime\n";
+
+    SetHorizons();
+
+    // Every rule runs the same budgets, the target is the discounted
+    // return of UCB1 at the largest budget less one standard error
+    vector<vector<double> > returns(numRules);
+    double target = -Infinity;
+    for (int rule = 0; rule < numRules; rule++)
+    {
+        SearchParams.SelectionRule = rule;
+        for (int i = ExpParams.MinDoubles; i <= ExpParams.MaxDoubles; i++)
+        {
+            cout << "Selection = " << names[rule] << endl;
+            RunDoubles(i, names[rule]);
+
+            returns[rule].push_back(Results.DiscountedReturn.GetMean());
+            if (rule == MCTS::SELECT_UCB1 && i == ExpParams.MaxDoubles)
+                target = Results.DiscountedReturn.GetMean()
+                    - Results.DiscountedReturn.GetStdErr();
         }
+    }
+    SearchParams.SelectionRule = selectionRule;
 
-        cout << "Simulations = " << SearchParams.NumSimulations << endl
-            << "Runs = " << Results.Time.GetCount() << endl
-            << "Undiscounted return = " << Results.UndiscountedReturn.GetMean()
-            << " +- " << Results.UndiscountedReturn.GetStdErr() << endl
-            << "Discounted return = " << Results.DiscountedReturn.GetMean()
-            << " +- " << Results.DiscountedReturn.GetStdErr() << endl
-            << "Time = " << Results.Time.GetMean() << endl;
-        OutputFile << SearchParams.NumSimulations << "\t"
-            << Results.Time.GetCount() << "\t"
-            << Results.UndiscountedReturn.GetMean() << "\t"
-            << Results.UndiscountedReturn.GetStdErr() << "\t"
-            << Results.DiscountedReturn.GetMean() << "\t"
-            << Results.DiscountedReturn.GetStdErr() << "\t"
-            << Results.Time.GetMean() << endl;
+    cout << "Target discounted return = " << target << endl;
+    for (int rule = 0; rule < numRules; rule++)
+    {
+        size_t k = 0;
+        while (k < returns[rule].size() && returns[rule][k] < target)
+            k++;
+        cout << names[rule];
+        if (k < returns[rule].size())
+            cout << " reaches it with "
+                << (1 << (ExpParams.MinDoubles + k)) << " simulations" << endl;
+        else
+            cout << " does not reach it" << endl;
     }
 }
 
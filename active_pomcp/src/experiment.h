@@ -1,6 +1,7 @@
 #ifndef EXPERIMENT_H
 #define EXPERIMENT_H
 
+#include "budget.h"
 #include "mcts.h"
 #include "simulator.h"
 #include "statistic.h"
@@ -58,17 +59,33 @@ public:
         fixed_seed = s;
     }
 
+    void set_budget(const BUDGET::PARAMS& params) {
+        Budget = BUDGET(params);
+    }
+
+    // Cheaper model for the rollouts of every search
+    void set_rollout_simulator(const SIMULATOR* s) {
+        RolloutSimulator = s;
+    }
+
     void Run();
     void MultiRun();
     void DiscountedReturn();
     void AverageReward();
+    void CompareSelection();
 
 private:
+    void SetHorizons();
+    // Runs of 2^i simulations, reported with label in the output file
+    void RunDoubles(int i, const std::string& label = "");
+
     const SIMULATOR& Real;
     const SIMULATOR& Simulator;
     EXPERIMENT::PARAMS& ExpParams;
     MCTS::PARAMS& SearchParams;
     RESULTS Results;
+    BUDGET Budget = BUDGET(BUDGET::PARAMS());
+    const SIMULATOR* RolloutSimulator = nullptr;
 
     bool use_fixed_seed = false;
     int fixed_seed = -1;
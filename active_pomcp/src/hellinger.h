@@ -3,7 +3,13 @@
 #include <vector>
 #include <array>
 #include <math.h>
+#include <limits>
 #include <iostream>
+#include <assert.h>
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /*
  * Discrete Hellinger distance between two distributions
@@ -106,3 +112,269 @@ private:
     // directly stored as sqrt(points)
     std::vector<std::array<double, N>> pts;
 };
+
+/*
+ * INDEXED IMPLEMENTATION
+ * Points are stored as sqrt(points), so the hellinger distance is the
+ * euclidean distance scaled by 1/sqrt(2), and indexed by a KD-tree. Each leaf
+ * holds a block of LEAF_SIZE points in coordinate-major order, evaluated with
+ * SIMD; unused slots are padded with points at infinity.
+ */
+template<size_t N>
+class hellinger_tree {
+public:
+     hellinger_tree() : radius2(2 * 0.1 * 0.1), nodes(), leaves() {
+     }
+
+     hellinger_tree(double c, const std::vector<std::array<double, N>> &p)
+         : radius2(2 * c * c), nodes(), leaves() {
+         set_points(p);
+     }
+
+     void set_points(const std::vector<std::array<double, N>> &points) {
+         nodes.clear();
+         leaves.clear();
+         if (points.empty())
+             return;
+
+         std::vector<std::array<double, N>> pts(points);
+         for (auto &p : pts)
+             for (double &d : p)
+                 d = std::sqrt(d);
+         build(pts, 0, pts.size());
+     }
+
+     void set_threshold(double t) {
+         radius2 = 2 * t * t;
+     }
+
+     bool is_in_threshold(const std::array<double, N> q) const {
+         return !nodes.empty() && sqrt_in_threshold(sqrt_point(q));
+     }
+
+     // one answer per query, the queries share a single pass over the
+     // sqrt transform
+     void is_in_threshold(const std::vector<std::array<double, N>> &qs,
+             std::vector<bool> &out) const {
+         out.assign(qs.size(), false);
+         if (nodes.empty())
+             return;
+         std::vector<std::array<double, N>> sqs(qs.size());
+         for (size_t i = 0; i < qs.size(); ++i)
+             sqs[i] = sqrt_point(qs[i]);
+         for (size_t i = 0; i < sqs.size(); ++i)
+             out[i] = sqrt_in_threshold(sqs[i]);
+     }
+
+     static void UnitTest();
+
+private:
+    static const int LEAF_SIZE = 8;
+
+    struct node {
+        std::array<double, N> lo, hi; // bounding box
+        int dim;
+        double split;
+        int left, right;
+        int leaf; // -1 for inner nodes
+    };
+
+    static std::array<double, N> sqrt_point(const std::array<double, N> &q) {
+        std::array<double, N> sq;
+        for (size_t j = 0; j < N; ++j)
+            sq[j] = std::sqrt(q[j]);
+        return sq;
+    }
+
+    // KD-tree walk for a sqrt transformed query: depth first, nearest child
+    // first, stop at the first hit
+    bool sqrt_in_threshold(const std::array<double, N> &sq) const {
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const node &n = nodes[stack[--top]];
+            if (box_distance(n, sq) > radius2)
+                continue;
+            // the whole box is close enough, any of its points is a hit
+            if (box_far_distance(n, sq) <= radius2)
+                return true;
+            if (n.leaf >= 0) {
+                if (leaf_in_threshold(n.leaf, sq))
+                    return true;
+                continue;
+            }
+            bool left_first = sq[n.dim] <= n.split;
+            stack[top++] = left_first ? n.right : n.left;
+            stack[top++] = left_first ? n.left : n.right;
+        }
+        return false;
+    }
+
+    // squared distance from q to the bounding box of n
+    static double box_distance(const node &n, const std::array<double, N> &q) {
+        double sum = 0.0;
+        for (size_t j = 0; j < N; ++j) {
+            double d = std::max(0.0, std::max(n.lo[j] - q[j], q[j] - n.hi[j]));
+            sum += d * d;
+        }
+        return sum;
+    }
+
+    // squared distance from q to the farthest corner of the bounding box of n
+    static double box_far_distance(const node &n, const std::array<double, N> &q) {
+        double sum = 0.0;
+        for (size_t j = 0; j < N; ++j) {
+            double d = std::max(q[j] - n.lo[j], n.hi[j] - q[j]);
+            sum += d * d;
+        }
+        return sum;
+    }
+
+    bool leaf_in_threshold(int leaf, const std::array<double, N> &q) const {
+        const double *block = &leaves[leaf * N * LEAF_SIZE];
+#ifdef __SSE2__
+        const __m128d r = _mm_set1_pd(radius2);
+        for (int k = 0; k < LEAF_SIZE; k += 2) {
+            __m128d sum = _mm_setzero_pd();
+            for (size_t j = 0; j < N; ++j) {
+                __m128d d = _mm_sub_pd(_mm_loadu_pd(block + j * LEAF_SIZE + k),
+                                       _mm_set1_pd(q[j]));
+                sum = _mm_add_pd(sum, _mm_mul_pd(d, d));
+            }
+            if (_mm_movemask_pd(_mm_cmple_pd(sum, r)))
+                return true;
+        }
+        return false;
+#else
+        double sum[LEAF_SIZE] = {};
+        for (size_t j = 0; j < N; ++j) {
+            for (int k = 0; k < LEAF_SIZE; ++k) {
+                double d = block[j * LEAF_SIZE + k] - q[j];
+                sum[k] += d * d;
+            }
+        }
+        bool found = false;
+        for (int k = 0; k < LEAF_SIZE; ++k)
+            found |= sum[k] <= radius2;
+        return found;
+#endif
+    }
+
+    int build(std::vector<std::array<double, N>> &pts, size_t begin, size_t end) {
+        int id = nodes.size();
+        nodes.emplace_back();
+        node n;
+        n.lo = n.hi = pts[begin];
+        for (size_t i = begin + 1; i < end; ++i) {
+            for (size_t j = 0; j < N; ++j) {
+                n.lo[j] = std::min(n.lo[j], pts[i][j]);
+                n.hi[j] = std::max(n.hi[j], pts[i][j]);
+            }
+        }
+        n.dim = 0;
+        n.split = 0.0;
+        n.left = n.right = n.leaf = -1;
+
+        if (end - begin <= LEAF_SIZE) {
+            n.leaf = leaves.size() / (N * LEAF_SIZE);
+            leaves.resize(leaves.size() + N * LEAF_SIZE,
+                          std::numeric_limits<double>::infinity());
+            double *block = &leaves[n.leaf * N * LEAF_SIZE];
+            for (size_t i = begin; i < end; ++i)
+                for (size_t j = 0; j < N; ++j)
+                    block[j * LEAF_SIZE + (i - begin)] = pts[i][j];
+            nodes[id] = n;
+            return id;
+        }
+
+        // split the widest dimension at the median
+        for (size_t j = 1; j < N; ++j)
+            if (n.hi[j] - n.lo[j] > n.hi[n.dim] - n.lo[n.dim])
+                n.dim = j;
+        size_t mid = begin + (end - begin) / 2;
+        int dim = n.dim;
+        std::nth_element(pts.begin() + begin, pts.begin() + mid, pts.begin() + end,
+            [dim](const std::array<double, N> &a, const std::array<double, N> &b) {
+                return a[dim] < b[dim];
+            });
+        n.split = pts[mid][dim];
+        n.left = build(pts, begin, mid);
+        n.right = build(pts, mid, end);
+        nodes[id] = n;
+        return id;
+    }
+
+    double radius2; // 2 * threshold^2, on sqrt(points)
+    std::vector<node> nodes;
+    std::vector<double> leaves;
+};
+
+/*
+ * Same answers as the direct implementation, single and batch queries, on
+ * empty sets, sets around the leaf size, duplicate points and queries at the
+ * stored points
+ */
+template<size_t N>
+void hellinger_tree<N>::UnitTest() {
+    auto random_point = []() {
+        std::array<double, N> p;
+        double sum = 0.0;
+        for (double &d : p) {
+            d = rand() / (double) RAND_MAX;
+            sum += d;
+        }
+        if (N > 1 && sum > 0)
+            for (double &d : p)
+                d /= sum;
+        return p;
+    };
+
+    std::vector<size_t> sizes = {0, 1, LEAF_SIZE - 1, LEAF_SIZE, LEAF_SIZE + 1,
+                                 2 * LEAF_SIZE + 1, 100, 1000};
+    for (size_t size : sizes) {
+        for (bool duplicates : {false, true}) {
+            std::vector<std::array<double, N>> pts;
+            for (size_t i = 0; i < size; ++i) {
+                auto p = duplicates && i % 3 ? pts[i / 2] : random_point();
+                pts.push_back(p);
+            }
+
+            for (double t : {0.0, 0.01, 0.05, 0.2, 1.0}) {
+                hellinger_shield<N> direct(t, pts);
+                hellinger_tree<N> tree(t, pts);
+                std::vector<std::array<double, N>> qs;
+                for (int i = 0; i < 200; ++i) {
+                    auto q = random_point();
+                    assert(tree.is_in_threshold(q) == direct.is_in_threshold(q));
+                    qs.push_back(q);
+                }
+                qs.insert(qs.end(), pts.begin(), pts.end());
+                std::vector<bool> inside;
+                tree.is_in_threshold(qs, inside);
+                assert(inside.size() == qs.size());
+                for (size_t i = 0; i < qs.size(); ++i)
+                    assert(inside[i] == direct.is_in_threshold(qs[i]));
+                for (const auto &p : pts) {
+                    assert(tree.is_in_threshold(p));
+                    assert(tree.is_in_threshold(p) == direct.is_in_threshold(p));
+                    (void) p;
+                }
+            }
+        }
+    }
+
+    // disjoint supports are at distance 1; the leaf box reaches the query
+    // but its padded slots must not
+    if (N > 2) {
+        std::vector<std::array<double, N>> pts(N - 1);
+        for (size_t j = 1; j < N; ++j)
+            pts[j - 1][j] = 1.0;
+        std::array<double, N> q{};
+        q[0] = 1.0;
+        hellinger_tree<N> tree(0.8, pts);
+        assert(!tree.is_in_threshold(q));
+        tree.set_threshold(1.0);
+        assert(tree.is_in_threshold(q));
+    }
+}
@@ -2,6 +2,7 @@
 #define HISTORY_H
 
 #include <vector>
+#include <cstdint>
 #include <ostream>
 #include <assert.h>
 
@@ -13,12 +14,13 @@ public:
     {
         ENTRY() { }
 
-        ENTRY(int action, uint64_t obs)
-        :   Action(action), Observation(obs)
+        ENTRY(int action, uint64_t obs, uint64_t key)
+        :   Action(action), Observation(obs), Key(key)
         { }
         
         int Action;
         uint64_t Observation;
+        uint64_t Key; // sum of the step keys up to here
     };
     
     bool operator==(const HISTORY& history) const
@@ -32,9 +34,16 @@ public:
         return true;
     }
     
-    void Add(int action, int obs = -1) 
+    // key: Zobrist style key of the step, accumulated by addition so that
+    // histories with the same multiset of steps get the same key
+    void Add(int action, int obs = -1, uint64_t key = 0) 
     { 
-        History.push_back(ENTRY(action, obs));
+        History.push_back(ENTRY(action, obs, GetKey() + key));
+    }
+
+    uint64_t GetKey() const
+    {
+        return History.empty() ? 0 : History.back().Key;
     }
     
     void Pop()
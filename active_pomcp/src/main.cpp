@@ -5,6 +5,7 @@
 #include "network.h"
 #include "obstacleavoidance.h"
 #include "pocman.h"
+#include "pomdp.h"
 #include "rocksample.h"
 #include "refuel.h"
 #include "tag.h"
@@ -19,8 +20,25 @@ using namespace boost::program_options;
 void UnitTests() {
     cout << "Testing UTILS" << endl;
     UTILS::UnitTest();
+    cout << "Testing action masks" << endl;
+    ROCKSAMPLE rocksample(7, 8);
+    SIMULATOR::UnitTestActionMask(rocksample);
+    MICRO_POCMAN pocman;
+    SIMULATOR::UnitTestActionMask(pocman);
+    TIGER tiger;
+    SIMULATOR::UnitTestActionMask(tiger);
+    cout << "Testing BELIEF_STATE" << endl;
+    BELIEF_STATE::UnitTest();
+    cout << "Testing hellinger_tree" << endl;
+    hellinger_tree<1>::UnitTest();
+    hellinger_tree<2>::UnitTest();
+    hellinger_tree<3>::UnitTest();
+    cout << "Testing AMAF" << endl;
+    AMAF_WEIGHTS::UnitTest();
     cout << "Testing COORD" << endl;
     COORD::UnitTest();
+    cout << "Testing POMDP" << endl;
+    POMDP::UnitTest();
     cout << "Testing MCTS" << endl;
     MCTS::UnitTest();
 }
@@ -37,13 +55,14 @@ void disableBufferedIO() {
 int main(int argc, char *argv[]) {
     MCTS::PARAMS searchParams;
     EXPERIMENT::PARAMS expParams;
+    BUDGET::PARAMS budgetParams;
     SIMULATOR::KNOWLEDGE knowledge;
     string problem, outputfile, policy;
     int size, number, treeknowledge = 0, rolloutknowledge = 1,
                       smarttreecount = 10;
     double smarttreevalue = 1.0;
     int random_seed = 12345678;
-    std::string shield_file;
+    std::string shield_file, model_file;
 
     double W = 0.0;
     bool complex_shield = false, xes_log = true;
@@ -55,6 +74,39 @@ int main(int argc, char *argv[]) {
         ("problem", value<string>(&problem), "problem to run")
         ("outputfile", value<string>(&outputfile)->default_value("output.txt"), "summary output file")
         ("policy", value<string>(&policy), "policy file (explicit POMDPs only)")
+        ("modelfile", value<string>(&model_file), "model file in .pomdp format (explicit POMDPs only)")
+        ("exactbelief", value<bool>(&searchParams.ExactBelief), "Track the exact belief instead of particles (if supported)")
+        ("particlefilter", value<bool>(&searchParams.UseParticleFilter), "Update the belief with a weighted particle filter (if supported)")
+        ("refilltarget", value<int>(&searchParams.RefillTarget), "Refill the belief to this many particles after each step (0 to disable)")
+        ("refillattempts", value<int>(&searchParams.RefillAttempts), "Refill attempts for each missing particle")
+        ("deduplicate", value<bool>(&searchParams.Deduplicate), "Store each distinct particle once with a count (if supported)")
+        ("nodesamples", value<int>(&searchParams.MaxNodeSamples), "Maximum particles stored in each node, by reservoir sampling (0 for no limit)")
+        ("sampledepth", value<int>(&searchParams.SampleDepth), "Deepest tree level whose nodes store particles")
+        ("transpositions", value<bool>(&searchParams.Transpositions), "Share nodes between histories with the same signature (if supported)")
+        ("wideningk", value<double>(&searchParams.WideningConstant), "Progressive widening: at most k n^alpha observation children per action node (0 to disable)")
+        ("wideningalpha", value<double>(&searchParams.WideningExponent), "Progressive widening exponent alpha")
+        ("abstractobs", value<bool>(&searchParams.AbstractObservations), "Branch the tree on abstract observations (if supported)")
+        ("abstractdepth", value<int>(&searchParams.AbstractionDepth), "Tree levels that branch on the real observation before abstracting (at least 1)")
+        ("openloop", value<bool>(&searchParams.OpenLoop), "Ignore observations below the root's children (open loop search)")
+        ("rolloutlength", value<int>(&searchParams.RolloutLength), "Truncate rollouts after this many steps and evaluate the leaf (0 for no limit)")
+        ("rollouttolerance", value<double>(&searchParams.RolloutTolerance), "Truncate rollouts once discount^k times the reward range falls below this, and evaluate the leaf")
+        ("stopinterval", value<int>(&searchParams.StopInterval), "Check every this many simulations whether the best root action looks settled, by a heuristic variance test, and stop the search if so (0 to disable)")
+        ("stoptolerance", value<double>(&searchParams.StopTolerance), "Tolerance of the heuristic early stopping test, smaller stops later (not an error rate)")
+        ("budget", value<int>(&budgetParams.Mode), "Episode simulation budget (0=Uniform, 1=Belief entropy, 2=Root value gap)")
+        ("budgetsteps", value<int>(&budgetParams.EpisodeSteps), "Expected decisions per episode, the episode budget is this many times the simulations")
+        ("budgetmin", value<double>(&budgetParams.MinScale), "Smallest step budget, as a fraction of the simulations per decision; an easy decision also gets this fraction of the even share")
+        ("budgetmax", value<double>(&budgetParams.MaxScale), "Largest step budget, as a multiple of the even share")
+        ("selection", value<int>(&searchParams.SelectionRule), "Action selection in the tree (0=UCB1, 1=UCB-V, 2=Thompson sampling)")
+        ("compareselection", "Run every selection rule over the same budgets and report the simulations each needs to match UCB1")
+        ("pairedrollouts", value<bool>(&searchParams.PairedRollouts), "Run simulations in pairs from the same root sample and random streams (common random numbers, not antithetic draws), for the UCB action and its best legal sibling")
+        ("controlvariate", value<double>(&searchParams.ControlVariate), "Coefficient of the expected reward control variate in rollouts (0 to disable, if supported)")
+        ("macroactions", value<int>(&searchParams.MacroActions), "Macro actions in the tree where the problem has them, rocksample and refuel (0=None, 1=Next to the primitive actions, 2=In place of the moves)")
+        ("macrolength", value<int>(&searchParams.MacroLength), "Most primitive steps of one macro action (0 for the search horizon)")
+        ("smc", value<bool>(&searchParams.SmcSearch), "Search a tree of particle beliefs filtered with the observation model, instead of sampled histories (if supported)")
+        ("smcparticles", value<int>(&searchParams.SmcParticles), "Particles in each belief of the SMC tree")
+        ("smcpool", value<double>(&searchParams.SmcPoolProbability), "Observations less likely than this share one node of the SMC tree")
+        ("fastrollouts", "Roll out with a cheaper approximate model of the problem where there is one (pocman, obstacleavoidance), the tree keeps the exact one")
+        ("maxtreenodes", value<int>(&searchParams.MaxTreeNodes), "Node budget for the search tree, least visited leaves are evicted beyond it (0 for no limit)")
         ("size", value<int>(&size), "size of problem (problem specific)")
         ("number", value<int>(&number), "number of elements in problem (problem specific)")
         ("timeout", value<double>(&expParams.TimeOut), "timeout (seconds)")
@@ -73,13 +125,18 @@ int main(int argc, char *argv[]) {
         ("userave", value<bool>(&searchParams.UseRave), "RAVE")
         ("ravediscount", value<double>(&searchParams.RaveDiscount), "RAVE discount factor")
         ("raveconstant", value<double>(&searchParams.RaveConstant), "RAVE bias constant")
+        ("ravefirst", value<bool>(&searchParams.RaveFirstOccurrence), "RAVE only credits the first occurrence of each action")
         ("treeknowledge", value<int>(&knowledge.TreeLevel), "Knowledge level in tree (0=Pure, 1=Legal, 2=Smart)")
         ("rolloutknowledge", value<int>(&knowledge.RolloutLevel), "Knowledge level in rollouts (0=Pure, 1=Legal, 2=Smart)")
         ("smarttreecount", value<int>(&knowledge.SmartTreeCount), "Prior count for preferred actions during smart tree search")
         ("smarttreevalue", value<double>(&knowledge.SmartTreeValue), "Prior value for preferred actions during smart tree search")
+        ("ruletreecount", value<int>(&knowledge.RuleTreeCount), "Prior count for the actions the shield file rules recommend at a node's belief (0 for none)")
+        ("ruletreevalue", value<double>(&knowledge.RuleTreeValue), "Prior value for the actions the shield file rules recommend")
         ("disabletree", value<bool>(&searchParams.DisableTree), "Use 1-ply rollout action selection")
         ("seed", value<int>(&random_seed), "set random seed (-1 to initialize using time, >= 0 to use a fixed integer as the initial seed)")
         ("useshield", value<bool>(&searchParams.use_shield), "Use preshield (if supported)")
+        ("shieldtree", value<bool>(&searchParams.ShieldTree), "Shield every node of the search tree, not just the root (with useshield)")
+        ("shieldparticles", value<int>(&searchParams.ShieldParticles), "Particles a node needs before its shield and rule prior are computed")
         ("complexshield", value<bool>(&complex_shield), "Use complex shield (if supported)")
         ("shieldfile", value<std::string>(&shield_file), "Specify file with shield parameters")
         ("setW", value<double>(&W), "Fix the reward range (testing purpouse)")
@@ -107,6 +164,10 @@ int main(int argc, char *argv[]) {
 
     std::unique_ptr<SIMULATOR> real = nullptr;
     std::unique_ptr<SIMULATOR> simulator = nullptr;
+    std::unique_ptr<SIMULATOR> rollout = nullptr;
+    bool fastRollouts = vm.count("fastrollouts") != 0;
+    // The shield file holds the rules for the rule prior too
+    bool loadShield = searchParams.use_shield || knowledge.RuleTreeCount > 0;
 
     XES::init(xes_log, "log.xes");
 
@@ -119,12 +180,17 @@ int main(int argc, char *argv[]) {
     } else if (problem == "pocman") {
         real = std::make_unique<FULL_POCMAN>();
         simulator = std::make_unique<FULL_POCMAN>();
+        if (fastRollouts) {
+            auto pocman = std::make_unique<FULL_POCMAN>();
+            pocman->SetRolloutModel(true);
+            rollout = std::move(pocman);
+        }
     } else if (problem == "network") {
         real = std::make_unique<NETWORK>(size, number);
         simulator = std::make_unique<NETWORK>(size, number);
     } else if (problem == "rocksample") {
         real = std::make_unique<ROCKSAMPLE>(size, number);
-        if (searchParams.use_shield)
+        if (loadShield)
             simulator = std::make_unique<ROCKSAMPLE>(size, number, shield_file);
         else
             simulator = std::make_unique<ROCKSAMPLE>(size, number);
@@ -133,7 +199,7 @@ int main(int argc, char *argv[]) {
         simulator = std::make_unique<TAG>(number);
     } else if (problem == "tiger") {
         real = std::make_unique<TIGER>(); // Real simulator (environment)
-        if (searchParams.use_shield)
+        if (loadShield)
             simulator = std::make_unique<TIGER>(shield_file);
         else
             simulator = std::make_unique<TIGER>();
@@ -213,7 +279,7 @@ int main(int argc, char *argv[]) {
             nSubSegs, subSegLengths, nEnginePowerValues, nDifficultyValues,
             nVelocityValues);
 
-        if (searchParams.use_shield)
+        if (loadShield)
             simulator = std::make_unique<OBSTACLEAVOIDANCE>(
                 nSubSegs, subSegLengths, nEnginePowerValues, nDifficultyValues,
                 nVelocityValues, shield_file);
@@ -223,6 +289,13 @@ int main(int argc, char *argv[]) {
                 nVelocityValues);
         dynamic_cast<OBSTACLEAVOIDANCE &>(*real).set_visual(visual);
         dynamic_cast<OBSTACLEAVOIDANCE &>(*simulator).set_visual(visual);
+        if (fastRollouts) {
+            auto obstacle = std::make_unique<OBSTACLEAVOIDANCE>(
+                nSubSegs, subSegLengths, nEnginePowerValues, nDifficultyValues,
+                nVelocityValues);
+            obstacle->set_rollout_model(true);
+            rollout = std::move(obstacle);
+        }
     } else if (problem == "battery") {
         /* ICE SMALL */
         std::vector<int> nSubSegs = {3, 5, 2, 3, 2, 5, 4, 11};
@@ -245,7 +318,7 @@ int main(int argc, char *argv[]) {
             nSubSegs, subSegLengths, nEnginePowerValues, nDifficultyValues,
             nVelocityValues);
 
-        if (searchParams.use_shield)
+        if (loadShield)
             simulator = std::make_unique<OBSTACLEAVOIDANCE>(
                 nSubSegs, subSegLengths, nEnginePowerValues, nDifficultyValues,
                 nVelocityValues, shield_file);
@@ -253,6 +326,12 @@ int main(int argc, char *argv[]) {
             simulator = std::make_unique<OBSTACLEAVOIDANCE>(
                 nSubSegs, subSegLengths, nEnginePowerValues, nDifficultyValues,
                 nVelocityValues);
+    } else if (problem == "pomdp") {
+        real = std::make_unique<POMDP>(model_file);
+        auto pomdp = std::make_unique<POMDP>(model_file);
+        if (vm.count("policy") != 0)
+            pomdp->LoadPolicy(policy);
+        simulator = std::move(pomdp);
     } else {
         cout << "Unknown problem" << endl;
         exit(1);
@@ -268,16 +347,23 @@ int main(int argc, char *argv[]) {
     }
 
     simulator->SetKnowledge(knowledge);
+    if (rollout)
+        rollout->SetKnowledge(knowledge);
 
     EXPERIMENT experiment(*real, *simulator, outputfile, expParams,
                           searchParams);
+    experiment.set_budget(budgetParams);
+    experiment.set_rollout_simulator(rollout.get());
 
 
     if (vm.count("random_seed") != 0) {
         experiment.set_fixed_seed(random_seed);
     }
 
-    experiment.DiscountedReturn();
+    if (vm.count("compareselection") != 0)
+        experiment.CompareSelection();
+    else
+        experiment.DiscountedReturn();
 
     return 0;
 }
@@ -22,42 +22,133 @@ MCTS::PARAMS::PARAMS()
     UseRave(false),
     RaveDiscount(1.0),
     RaveConstant(0.01),
+    RaveFirstOccurrence(false),
     DisableTree(false),
-    use_shield(false)
+    use_shield(false),
+    ShieldTree(false),
+    ShieldParticles(16),
+    ExactBelief(false),
+    UseParticleFilter(false),
+    RefillTarget(0),
+    RefillAttempts(10),
+    Deduplicate(false),
+    MaxNodeSamples(0),
+    SampleDepth(1),
+    MaxTreeNodes(0),
+    Transpositions(false),
+    WideningConstant(0),
+    WideningExponent(0.5),
+    AbstractObservations(false),
+    AbstractionDepth(1),
+    OpenLoop(false),
+    RolloutLength(0),
+    RolloutTolerance(0),
+    StopInterval(0),
+    StopTolerance(0.05),
+    SelectionRule(SELECT_UCB1),
+    PairedRollouts(false),
+    ControlVariate(0),
+    MacroActions(MACRO_NONE),
+    MacroLength(0),
+    SmcSearch(false),
+    SmcParticles(100),
+    SmcPoolProbability(0.05)
 {
 }
 
 MCTS::MCTS(const SIMULATOR& simulator, const PARAMS& params)
 :   Simulator(simulator),
+    RolloutSimulator(0),
     Params(params),
     TreeDepth(0),
-    PeakTreeDepth(0)
+    PeakTreeDepth(0),
+    ExactBelief(0),
+    MetaPrototype(0),
+    Evictions(0),
+    EvictionFloor(0),
+    SmcRoot(0),
+    SmcNodes(0),
+    SmcPooled(0),
+    Simulations(0),
+    RootMinReturn(+Infinity),
+    RootMaxReturn(-Infinity),
+    RootGap(-1),
+    PairSeeds(rand())
 {
-    VNODE::NumChildren = Simulator.GetNumActions();
+    UseTranspositions = Params.Transpositions && Simulator.HasHistorySignature();
+
+    NumTreeActions = Simulator.GetNumActions();
+    if (Params.MacroActions != MACRO_NONE)
+        NumTreeActions += Simulator.GetNumMacros();
+    VNODE::NumChildren = NumTreeActions;
     QNODE::NumChildren = Simulator.GetNumObservations();
 
+    if (Params.ExactBelief && Simulator.HasExactBelief())
+        ExactBelief = Simulator.CreateExactBelief();
+
     Root = ExpandNode(Simulator.CreateStartState());
+    if (Root->Beliefs().has_metainfo())
+        MetaPrototype = Root->Beliefs().get_metainfo().clone();
 
-    for (int i = 0; i < Params.NumStartStates; i++) {
-        Root->Beliefs().AddSample(Simulator.CreateStartState());
-    }
+    if (ExactBelief)
+        RefillExactBelief(Root);
+    else
+        for (int i = 0; i < Params.NumStartStates; i++) {
+            Root->Beliefs().AddSample(Simulator.CreateStartState());
+        }
 }
 
 MCTS::~MCTS()
 {
-    VNODE::Free(Root, Simulator);
+    FreeTree();
     VNODE::FreeAll();
+    SMC_VNODE::FreeAll();
+    if (ExactBelief)
+        Simulator.FreeMetainfo(ExactBelief);
+    if (MetaPrototype)
+        Simulator.FreeMetainfo(MetaPrototype);
 }
 
 bool MCTS::Update(int action, SIMULATOR::observation_t observation, double reward)
 {
     History.Add(action, observation);
+    RootGap = ValueGap(Root->Child(action).Child(observation));
+
+    if (ExactBelief)
+    {
+        // Exact filtering: the particles are regenerated from the posterior,
+        // so the subtree below the matched node is not reused
+        if (!Simulator.UpdateExactBelief(*ExactBelief, action, observation))
+            return false;
+
+        FreeTree();
+        STATE* state = Simulator.CreateSample(*ExactBelief);
+        Root = ExpandNode(state);
+        Simulator.FreeState(state);
+        RefillExactBelief(Root);
+        return true;
+    }
+
     BELIEF_STATE beliefs;
+    if (Params.Deduplicate)
+        beliefs.EnableDeduplication(Simulator);
+
+    // Filter the whole root belief through the observation model
+    // The SMC search keeps no tree below the root, so it always filters
+    if ((Params.UseParticleFilter || Params.SmcSearch)
+        && Simulator.HasObservationProbability())
+        Resample(beliefs);
+    bool resampled = !beliefs.Empty();
 
     // Find matching vnode from the rest of the tree
     QNODE& qnode = Root->Child(action);
     VNODE* vnode = qnode.Child(observation);
-    if (vnode)
+    if (resampled)
+    {
+        if (Params.Verbose >= 1)
+            cout << "Resampled " << beliefs.GetTotalCount() << " states" << endl;
+    }
+    else if (vnode)
     {
         if (Params.Verbose >= 1)
             cout << "Matched " << vnode->Beliefs().GetNumSamples() << " states" << endl;
@@ -70,9 +161,13 @@ bool MCTS::Update(int action, SIMULATOR::observation_t observation, double rewar
     }
 
     // Generate transformed states to avoid particle deprivation
-    if (Params.UseTransforms)
+    if (Params.UseTransforms && !resampled)
         AddTransforms(Root, beliefs);
 
+    // Top the belief up to a fixed size
+    if (Params.RefillTarget > 0 && !resampled)
+        RefillBelief(beliefs);
+
     // If we still have no particles, fail
     if (beliefs.Empty() && (!vnode || vnode->Beliefs().Empty()))
         return false;
@@ -88,7 +183,7 @@ bool MCTS::Update(int action, SIMULATOR::observation_t observation, double rewar
         state = beliefs.GetSample(0);
 
     // Delete old tree and create new root
-    VNODE::Free(Root, Simulator);
+    FreeTree();
     VNODE* newRoot = ExpandNode(state);
     //std::swap(newRoot->Beliefs(), beliefs);
     newRoot->Beliefs().Move(beliefs);
@@ -100,6 +195,14 @@ int MCTS::SelectAction()
 {
     if (Params.DisableTree)
         RolloutSearch();
+    else if (Params.SmcSearch && Simulator.HasObservationProbability())
+    {
+        SmcSearch();
+        int action = SmcGreedy(SmcRoot, false);
+        SMC_VNODE::Free(SmcRoot, Simulator);
+        SmcRoot = 0;
+        return action;
+    }
     else
         UCTSearch();
 
@@ -108,7 +211,57 @@ int MCTS::SelectAction()
         return Simulator.shield_action(Root->Beliefs(), GreedyUCB(Root, false));
     else
     */
-    return GreedyUCB(Root, false);
+    int action = GreedyUCB(Root, false);
+    if (action >= Simulator.GetNumActions())
+        action = MacroRootAction(action - Simulator.GetNumActions());
+    if (action < 0)
+        action = Simulator.SelectRandom(*Root->Beliefs().GetSample(0),
+            History, Status);
+    return action;
+}
+
+int MCTS::MacroRootAction(int macro) const
+{
+    // The real step is the first primitive of the macro, by a vote over
+    // the root particles when it depends on the hidden state, -1 when the
+    // macro starts in none of them
+    const BELIEF_STATE& beliefs = Root->Beliefs();
+    vector<int> votes(Simulator.GetNumActions(), 0);
+    for (int i = 0; i < beliefs.GetNumSamples(); i++)
+    {
+        int action = Simulator.MacroAction(*beliefs.GetSample(i), macro);
+        if (action >= 0)
+            votes[action] += beliefs.GetCount(i);
+    }
+    int best = max_element(votes.begin(), votes.end()) - votes.begin();
+    return votes[best] > 0 ? best : -1;
+}
+
+void MCTS::ShieldMacros()
+{
+    // The shield judges primitives, so a macro is allowed at the root when
+    // the step it would really take is. With the macros in place of the
+    // moves, the covered primitives give way as in PriorMacros.
+    vector<int> macros;
+    for (int macro = 0; macro < Simulator.GetNumMacros(); macro++)
+    {
+        int action = Simulator.GetNumActions() + macro;
+        if (Root->Child(action).Value.GetCount() >= LargeInteger)
+            continue;
+        int step = MacroRootAction(macro);
+        if (find(legal_actions.begin(), legal_actions.end(), step)
+            != legal_actions.end())
+            macros.push_back(action);
+    }
+    if (macros.empty())
+        return;
+    if (Params.MacroActions == MACRO_ONLY)
+        legal_actions.erase(remove_if(legal_actions.begin(),
+            legal_actions.end(), [this](int action)
+            {
+                return Simulator.MacroCovers(action);
+            }), legal_actions.end());
+    legal_actions.insert(legal_actions.end(), macros.begin(), macros.end());
 }
 
 void MCTS::RolloutSearch()
@@ -123,17 +276,19 @@ void MCTS::RolloutSearch()
 	for (int i = 0; i < Params.NumSimulations; i++)
 	{
 		int action = legal[i % legal.size()];
-		STATE* state = Root->Beliefs().CreateSample(Simulator);
+		STATE* state = CreateRootSample();
 		Simulator.Validate(*state);
 
         SIMULATOR::observation_t observation;
 		double immediateReward, delayedReward, totalReward;
 		bool terminal = Simulator.Step(*state, action, observation, immediateReward);
 
-		VNODE*& vnode = Root->Child(action).Child(observation);
+		SIMULATOR::observation_t branch = BranchObservation(observation, 0);
+		VNODE*& vnode = Root->Child(action).Child(branch);
 		if (!vnode && !terminal)
 		{
 			vnode = ExpandNode(state);
+			Root->Child(action).AddExpanded(branch);
 			AddSample(vnode, *state);
 		}
 		History.Add(action, observation);
@@ -151,6 +306,10 @@ void MCTS::UCTSearch()
 {
     ClearStatistics();
     int historyDepth = History.Size();
+    Evictions = 0;
+    EvictionFloor = 0;
+    RootMinReturn = +Infinity;
+    RootMaxReturn = -Infinity;
 
     // compute legal action in root
     legal_actions.clear();
@@ -158,64 +317,456 @@ void MCTS::UCTSearch()
     if (Params.use_shield) {
         // initialize legal actions
         Simulator.pre_shield(Root->Beliefs(), legal_actions);
+        if (NumTreeActions > Simulator.GetNumActions())
+            ShieldMacros();
     }
 
-    for (int n = 0; n < Params.NumSimulations; n++)
+    int numChecks = Params.StopInterval > 0
+        ? max(1, Params.NumSimulations / Params.StopInterval) : 0;
+    int nextCheck = Params.StopInterval;
+    for (Simulations = 0; Simulations < Params.NumSimulations; )
     {
-        STATE* state = Root->Beliefs().CreateSample(Simulator);
-        Simulator.Validate(*state);
-        Status.Phase = SIMULATOR::STATUS::TREE;
-        if (Params.Verbose >= 2)
+        STATE* state = CreateRootSample();
+        int numActions = Params.use_shield
+            ? legal_actions.size() : Simulator.GetNumActions();
+        if (Params.PairedRollouts && numActions > 1
+            && Simulations + 1 < Params.NumSimulations)
+        {
+            // Common random numbers, not antithetic draws: the same root
+            // sample and the same random streams, rollout model included,
+            // once for the UCB action and once for the best of its legal
+            // siblings. The seeds come from their own generator, so that
+            // reseeding does not chain the streams of successive pairs.
+            STATE* pair = Simulator.Copy(*state);
+            int seed = PairSeeds() & RAND_MAX;
+            srand(seed);
+            Simulator.set_seed(seed);
+            if (RolloutSimulator)
+                RolloutSimulator->set_seed(seed);
+            int action = RunSimulation(state, -1, historyDepth);
+
+            TreeDepth = 0;
+            int sibling = GreedyUCB(Root, true, action, pair);
+            if (Root->Child(sibling).Value.GetCount() >= LargeInteger)
+            {
+                // Only illegal siblings, the simulation stays unpaired
+                Simulator.FreeState(pair);
+                Simulations++;
+            }
+            else
+            {
+                srand(seed);
+                Simulator.set_seed(seed);
+                if (RolloutSimulator)
+                    RolloutSimulator->set_seed(seed);
+                RunSimulation(pair, sibling, historyDepth);
+                Simulations += 2;
+            }
+        }
+        else
+        {
+            RunSimulation(state, -1, historyDepth);
+            Simulations++;
+        }
+
+        if (numChecks > 0 && Simulations >= nextCheck)
         {
-            cout << "Starting simulation" << endl;
-            Simulator.DisplayState(*state, cout);
+            nextCheck += Params.StopInterval;
+            if (Simulations < Params.NumSimulations && RootSettled(numChecks))
+                break;
         }
+    }
+    StatSimulations.Add(Simulations);
+    AddRootError();
+    if (Params.MaxTreeNodes > 0)
+        StatEvictions.Add(Evictions);
+    if (Params.WideningConstant > 0 && Params.Verbose >= 1)
+    {
+        StatBranching.Clear();
+        Visited.clear();
+        AddBranching(Root);
+    }
+    DisplayStatistics(cout);
+}
+
+void MCTS::SmcSearch()
+{
+    // Sequential Monte Carlo tree: each node holds a resampled particle
+    // belief, its children are the belief filtered with each observation.
+    // Simulations draw their state from the node's belief, so statistics
+    // are shared by the whole belief instead of a single history, and
+    // observations less likely than SmcPoolProbability share one node.
+    ClearStatistics();
+    int historyDepth = History.Size();
+    SMC_VNODE::NumChildren = Simulator.GetNumActions();
+    SMC_QNODE::NumChildren = Simulator.GetNumObservations() + 1;
+
+    // The root is shielded as in UCTSearch, the real action is one of these
+    legal_actions.clear();
+    if (Params.use_shield)
+        Simulator.pre_shield(Root->Beliefs(), legal_actions);
+
+    SmcRoot = SMC_VNODE::Create();
+    SmcRoot->Beliefs().Copy(Root->Beliefs(), Simulator);
+    SmcPrior(SmcRoot);
+    SmcNodes = 1;
+    SmcPooled = 0;
+
+    for (Simulations = 0; Simulations < Params.NumSimulations; Simulations++)
+    {
+        Status.Phase = SIMULATOR::STATUS::TREE;
         TreeDepth = 0;
         PeakTreeDepth = 0;
-        double totalReward = SimulateV(*state, Root);
+        double totalReward = SimulateSmcV(SmcRoot);
         StatTotalReward.Add(totalReward);
         StatTreeDepth.Add(PeakTreeDepth);
-
-        if (Params.Verbose >= 2)
-            cout << "Total reward = " << totalReward << endl;
-        if (Params.Verbose >= 3)
-            DisplayValue(4, cout);
-
-        Simulator.FreeState(state);
         History.Truncate(historyDepth);
     }
+    StatSimulations.Add(Simulations);
+    StatSmcNodes.Add(SmcNodes);
     DisplayStatistics(cout);
 }
 
-double MCTS::SimulateV(STATE& state, VNODE* vnode)
+double MCTS::SimulateSmcV(SMC_VNODE* vnode)
 {
-    int action = GreedyUCB(vnode, true);
+    PeakTreeDepth = TreeDepth;
+    if (TreeDepth >= Params.MaxDepth) // search horizon reached
+        return 0;
+
+    int action = SmcGreedy(vnode, true);
+    STATE* state = vnode->Beliefs().CreateSample(Simulator);
+    double totalReward = SimulateSmcQ(*state, vnode, action);
+    Simulator.FreeState(state);
+    vnode->Value.Add(totalReward);
+    return totalReward;
+}
+
+double MCTS::SimulateSmcQ(STATE& state, SMC_VNODE* vnode, int action)
+{
+    SIMULATOR::observation_t observation;
+    double immediateReward, delayedReward = 0;
+
+    bool terminal = Simulator.Step(state, action, observation, immediateReward);
+    History.Add(action, observation);
+
+    if (!terminal)
+    {
+        SMC_VNODE* child = SmcChild(vnode, action, observation);
+        TreeDepth++;
+        if (child)
+            delayedReward = SimulateSmcV(child);
+        else
+            delayedReward = Rollout(state);
+        TreeDepth--;
+    }
+
+    double totalReward = immediateReward + Simulator.GetDiscount() * delayedReward;
+    vnode->Child(action).Value.Add(totalReward);
+    return totalReward;
+}
+
+SMC_VNODE* MCTS::SmcChild(SMC_VNODE* vnode, int action,
+    SIMULATOR::observation_t observation)
+{
+    SMC_QNODE& qnode = vnode->Child(action);
+    SMC_VNODE*& child = qnode.Child(observation);
+    if (child || qnode.Value.GetCount() < Params.ExpandCount)
+        return child;
+
+    SMC_VNODE* filtered = SMC_VNODE::Create();
+    double probability = FilterParticles(vnode->Beliefs(), action,
+        observation, true, Params.SmcParticles, filtered->Beliefs());
+    if (probability >= Params.SmcPoolProbability
+        && !filtered->Beliefs().Empty())
+    {
+        filtered->Probability.Set(1, probability);
+        SmcPrior(filtered);
+        SmcNodes++;
+        child = filtered;
+        return child;
+    }
+    SMC_VNODE::Free(filtered, Simulator);
+
+    // Rare observation: share the belief predicted for the action,
+    // without the observation
+    SMC_VNODE*& pooled = qnode.Child(Simulator.GetNumObservations());
+    if (!pooled)
+    {
+        pooled = SMC_VNODE::Create();
+        FilterParticles(vnode->Beliefs(), action, observation, false,
+            Params.SmcParticles, pooled->Beliefs());
+        SmcPrior(pooled);
+        SmcNodes++;
+    }
+    if (pooled->Beliefs().Empty())
+        return 0;
+    pooled->Probability.Add(probability);
+    SmcPooled++;
+    child = pooled;
+    return child;
+}
+
+void MCTS::SmcPrior(SMC_VNODE* vnode) const
+{
+    // Legal actions of a particle, the other ones are ruled out
+    static vector<int> legal;
+    if (vnode->Beliefs().Empty())
+    {
+        vnode->SetChildren(0, 0);
+        return;
+    }
+    vnode->SetChildren(+LargeInteger, -Infinity);
+    legal.clear();
+    Simulator.GenerateLegal(*vnode->Beliefs().GetSample(0), History, legal,
+        Status);
+    if (Params.use_shield && vnode == SmcRoot)
+        legal.erase(remove_if(legal.begin(), legal.end(), [this](int action)
+            {
+                return find(legal_actions.begin(), legal_actions.end(),
+                    action) == legal_actions.end();
+            }), legal.end());
+    for (int action : legal)
+    {
+        vnode->Child(action).Value.Set(0, 0);
+        vnode->Child(action).AMAF.Set(0, 0);
+    }
+}
+
+int MCTS::SmcGreedy(const SMC_VNODE* vnode, bool ucb) const
+{
+    static vector<int> besta;
+    besta.clear();
+    double bestq = -Infinity;
+    int N = vnode->Value.GetCount();
+    double logN = log(N + 1);
+
+    // PRE-SHIELDING
+    static vector<int> candidates;
+    candidates.clear();
+    if (Params.use_shield && vnode == SmcRoot)
+        candidates = legal_actions;
+    else
+        for (int action = 0; action < SMC_VNODE::NumChildren; action++)
+            candidates.push_back(action);
+
+    for (int action : candidates)
+    {
+        const SMC_QNODE& qnode = vnode->Child(action);
+        double q = qnode.Value.GetValue();
+        if (ucb)
+            q += SelectionBonus(qnode.Value, N, qnode.Value.GetCount(), logN);
+
+        if (q >= bestq)
+        {
+            if (q > bestq)
+                besta.clear();
+            bestq = q;
+            besta.push_back(action);
+        }
+    }
+
+    assert(!besta.empty());
+    return besta[Random(besta.size())];
+}
+
+int MCTS::RunSimulation(STATE* state, int action, int historyDepth)
+{
+    Simulator.Validate(*state);
+    Status.Phase = SIMULATOR::STATUS::TREE;
+    if (Params.Verbose >= 2)
+    {
+        cout << "Starting simulation" << endl;
+        Simulator.DisplayState(*state, cout);
+    }
+    TreeDepth = 0;
+    PeakTreeDepth = 0;
+    Amaf.Reset(Simulator.GetNumActions(), Params.RaveFirstOccurrence);
+    AddRulePrior(Root);
+    if (action < 0)
+        action = GreedyUCB(Root, true, -1, state);
+    double totalReward = SimulateV(*state, Root, action);
+    StatTotalReward.Add(totalReward);
+    RootMinReturn = min(RootMinReturn, totalReward);
+    RootMaxReturn = max(RootMaxReturn, totalReward);
+    StatTreeDepth.Add(PeakTreeDepth);
+
+    if (Params.Verbose >= 2)
+        cout << "Total reward = " << totalReward << endl;
+    if (Params.Verbose >= 3)
+        DisplayValue(4, cout);
+
+    Simulator.FreeState(state);
+    History.Truncate(historyDepth);
+
+    // Evict down to 90% of the budget, so the tree is not walked
+    // after every simulation. When only the kept levels are left, the
+    // tree is not walked again before it grows by that margin.
+    if (Params.MaxTreeNodes > 0
+        && VNODE::GetNumAllocated() > max(Params.MaxTreeNodes, EvictionFloor))
+    {
+        Evictions += EvictLeaves(Params.MaxTreeNodes - Params.MaxTreeNodes / 10);
+        if (VNODE::GetNumAllocated() > Params.MaxTreeNodes)
+            EvictionFloor = VNODE::GetNumAllocated() + Params.MaxTreeNodes / 10;
+    }
+    return action;
+}
+
+void MCTS::AddRootError()
+{
+    // Mean standard error of the root action values, to compare the
+    // variance reduction options
+    STATISTIC error;
+    for (int action = 0; action < NumTreeActions; action++)
+    {
+        const VALUE<int>& value = Root->Child(action).Value;
+        if (value.GetCount() > 1 && value.GetCount() < LargeInteger)
+            error.Add(sqrt(value.GetVariance() / value.GetCount()));
+    }
+    if (error.GetCount() > 0)
+        StatRootError.Add(error.GetMean());
+}
+
+double MCTS::ValueGap(const VNODE* vnode) const
+{
+    // Primitive actions only, searched at least once
+    if (!vnode)
+        return -1;
+    double best = -Infinity, second = -Infinity;
+    for (int action = 0; action < Simulator.GetNumActions(); action++)
+    {
+        const VALUE<int>& value = vnode->Child(action).Value;
+        if (value.GetCount() == 0 || value.GetCount() >= LargeInteger)
+            continue;
+        double q = value.GetValue();
+        if (q > best)
+        {
+            second = best;
+            best = q;
+        }
+        else if (q > second)
+            second = q;
+    }
+    return second == -Infinity ? -1 : best - second;
+}
+
+bool MCTS::RootSettled(int numChecks) const
+{
+    vector<int> candidates;
+    if (Params.use_shield)
+        candidates = legal_actions;
+    else
+        for (int action = 0; action < NumTreeActions; action++)
+            candidates.push_back(action);
+
+    // Heuristic test, not a confidence bound. The returns are taken as
+    // Gaussian with each action's empirical variance, shrunk towards the
+    // largest variance the observed range of the root returns allows,
+    // range^2 / 4, by one pseudo-return, so a handful of equal returns is
+    // not trusted. It ignores that UCB makes the actions' samples
+    // dependent, and it has no range term linear in 1/n: the empirical
+    // Bernstein bound keeps the actions UCB starves of visits wide, and
+    // on tiger it never stops even at 2^16 simulations. StopTolerance is
+    // split over the actions and the checks like an error rate, but
+    // smaller is only more cautious, it is not a probability of error.
+    double logTerm = log(candidates.size() * numChecks / Params.StopTolerance);
+    double range = RootMaxReturn - RootMinReturn;
+    auto width = [&](const VALUE<int>& value)
+    {
+        double n = value.GetCount();
+        double variance = (n * value.GetVariance() + range * range / 4)
+            / (n + 1);
+        return sqrt(2 * variance * logTerm / n);
+    };
+    int best = -1;
+    double bestLower = -Infinity;
+    for (int action : candidates)
+    {
+        const VALUE<int>& value = Root->Child(action).Value;
+        if (value.GetCount() >= LargeInteger) // ruled out by the prior
+            continue;
+        if (value.GetCount() == 0)
+            return false;
+        double lower = value.GetValue() - width(value);
+        if (best < 0 || value.GetValue() > Root->Child(best).Value.GetValue())
+        {
+            best = action;
+            bestLower = lower;
+        }
+    }
+    if (best < 0)
+        return false;
+
+    for (int action : candidates)
+    {
+        const VALUE<int>& value = Root->Child(action).Value;
+        if (action == best || value.GetCount() >= LargeInteger)
+            continue;
+        double upper = value.GetValue() + width(value);
+        if (upper > bestLower)
+            return false;
+    }
+    return true;
+}
+
+double MCTS::SimulateV(STATE& state, VNODE* vnode, int action)
+{
+    AddRulePrior(vnode);
+    if (action < 0)
+        action = GreedyUCB(vnode, true, -1, &state);
 
     PeakTreeDepth = TreeDepth;
     if (TreeDepth >= Params.MaxDepth) // search horizon reached
         return 0;
 
-    if (TreeDepth == 1)
+    if (TreeDepth >= 1 && TreeDepth <= Params.SampleDepth && !ExactBelief)
         AddSample(vnode, state);
+    else if (TreeDepth >= 1 && NeedsParticles(vnode) && !ExactBelief)
+        AddSample(vnode, state); // until the node's belief rules are read
 
     QNODE& qnode = vnode->Child(action);
+    int position = History.Size();
     double totalReward = SimulateQ(state, qnode, action);
     vnode->Value.Add(totalReward);
-    AddRave(vnode, totalReward);
+    AddRave(vnode, position, totalReward);
     return totalReward;
 }
 
 double MCTS::SimulateQ(STATE& state, QNODE& qnode, int action)
 {
+    if (action >= Simulator.GetNumActions())
+        return SimulateMacro(state, qnode, action - Simulator.GetNumActions());
+
     SIMULATOR::observation_t observation;
     double immediateReward, delayedReward = 0;
 
     if (Simulator.HasAlpha())
-        Simulator.UpdateAlpha(qnode, state);
+        Simulator.UpdateAlpha(qnode, action, state);
 
     bool terminal = Simulator.Step(state, action, observation, immediateReward);
     assert(observation >= 0 && observation < Simulator.GetNumObservations());
-    History.Add(action, observation);
+    SIMULATOR::observation_t branch = BranchObservation(observation, TreeDepth);
+
+    // Progressive widening: a new observation gets a node only while the
+    // QNODE has fewer than k n^alpha children, otherwise the simulation
+    // goes on, with the same state, into an existing child (POMCP-DPW).
+    // The root's children are never widened, their particles are the next
+    // belief and must match their observation. The history keeps the real
+    // observation, only the branch is redirected.
+    if (Params.WideningConstant > 0 && TreeDepth >= 1 && !terminal
+        && !qnode.Child(branch)
+        && qnode.Expanded().size() >= Params.WideningConstant
+            * pow(qnode.Value.GetCount() + 1, Params.WideningExponent))
+    {
+        int widened = SelectWidened(qnode);
+        if (widened >= 0)
+            branch = widened;
+    }
+
+    if (UseTranspositions)
+        History.Add(action, observation,
+            Simulator.HistoryKey(state, action, observation));
+    else
+        History.Add(action, observation);
 
     if (Params.Verbose >= 3)
     {
@@ -225,9 +776,15 @@ double MCTS::SimulateQ(STATE& state, QNODE& qnode, int action)
         Simulator.DisplayState(state, cout);
     }
 
-    VNODE*& vnode = qnode.Child(observation);
+    VNODE*& vnode = qnode.Child(branch);
     if (!vnode && !terminal && qnode.Value.GetCount() >= Params.ExpandCount)
-        vnode = ExpandNode(&state);
+    {
+        if (UseTranspositions)
+            vnode = FindTransposition(state);
+        else
+            vnode = ExpandNode(&state);
+        qnode.AddExpanded(branch);
+    }
 
     if (!terminal)
     {
@@ -244,23 +801,161 @@ double MCTS::SimulateQ(STATE& state, QNODE& qnode, int action)
     return totalReward;
 }
 
-void MCTS::AddRave(VNODE* vnode, double totalReward)
+double MCTS::SimulateMacro(STATE& state, QNODE& qnode, int macro)
 {
-    double totalDiscount = 1.0;
-    for (int t = TreeDepth; t < History.Size(); ++t)
+    SIMULATOR::observation_t observation = 0;
+    double immediateReward = 0, delayedReward = 0, discount = 1.0;
+    bool terminal = false;
+    int maxSteps = Params.MaxDepth - TreeDepth;
+    if (Params.MacroLength > 0)
+        maxSteps = min(maxSteps, Params.MacroLength);
+
+    // The primitive steps make one edge, their rewards discounted from the
+    // start of the edge and the value below it by the steps taken
+    int numSteps;
+    for (numSteps = 0; numSteps < maxSteps && !terminal; ++numSteps)
     {
-        QNODE& qnode = vnode->Child(History[t].Action);
-        qnode.AMAF.Add(totalReward, totalDiscount);
-        totalDiscount *= Params.RaveDiscount;
+        int action = Simulator.MacroAction(state, macro);
+        if (action < 0)
+            break;
+
+        double reward;
+        terminal = Simulator.Step(state, action, observation, reward);
+        if (UseTranspositions)
+            History.Add(action, observation,
+                Simulator.HistoryKey(state, action, observation));
+        else
+            History.Add(action, observation);
+
+        if (Params.Verbose >= 3)
+        {
+            Simulator.DisplayAction(action, cout);
+            Simulator.DisplayObservation(state, observation, cout);
+            Simulator.DisplayReward(reward, cout);
+            Simulator.DisplayState(state, cout);
+        }
+
+        if (numSteps == 0 && TreeDepth == 0 && !terminal)
+            AddRootStep(action, observation, state);
+        immediateReward += discount * reward;
+        discount *= Simulator.GetDiscount();
     }
+    StatMacroLength.Add(numSteps);
+
+    // Not applicable to this particle, only when no action was: the macro
+    // was not taken, so its value is left alone
+    if (numSteps == 0)
+        return Rollout(state);
+
+    SIMULATOR::observation_t branch = BranchObservation(observation, TreeDepth);
+    VNODE*& vnode = qnode.Child(branch);
+    if (!vnode && !terminal && qnode.Value.GetCount() >= Params.ExpandCount)
+    {
+        if (UseTranspositions)
+            vnode = FindTransposition(state);
+        else
+            vnode = ExpandNode(&state);
+        qnode.AddExpanded(branch);
+    }
+
+    if (!terminal)
+    {
+        TreeDepth += numSteps;
+        if (vnode)
+            delayedReward = SimulateV(state, vnode);
+        else
+            delayedReward = Rollout(state);
+        TreeDepth -= numSteps;
+    }
+
+    double totalReward = immediateReward + discount * delayedReward;
+    qnode.Value.Add(totalReward);
+    return totalReward;
+}
+
+void MCTS::AddRootStep(int action, SIMULATOR::observation_t observation,
+    const STATE& state)
+{
+    // The real step is primitive, so the next belief is read from the
+    // primitive child even when the root explores through macros
+    if (ExactBelief || Params.SampleDepth < 1)
+        return;
+    SIMULATOR::observation_t branch = BranchObservation(observation, 0);
+    QNODE& qnode = Root->Child(action);
+    VNODE*& vnode = qnode.Child(branch);
+    if (!vnode)
+    {
+        if (UseTranspositions)
+            vnode = FindTransposition(state);
+        else
+            vnode = ExpandNode(&state);
+        qnode.AddExpanded(branch);
+    }
+    AddSample(vnode, state);
+}
+
+SIMULATOR::observation_t MCTS::BranchObservation(
+    SIMULATOR::observation_t observation, int depth) const
+{
+    // Open loop: below the root's children every observation takes the
+    // same branch, so nodes stand for action sequences and each simulation
+    // carries on with its own sampled state. The root's children still
+    // branch, their particles are the next belief.
+    if (Params.OpenLoop && depth >= 1)
+        return 0;
+
+    // Coarse to fine: the top AbstractionDepth levels branch on the real
+    // observation, the levels below on the abstract one. The root's
+    // children always branch on the real one, their particles are the
+    // next belief.
+    if (!Params.AbstractObservations
+        || depth < max(1, Params.AbstractionDepth))
+        return observation;
+    return Simulator.AbstractObservation(observation, History);
+}
+
+int MCTS::SelectWidened(const QNODE& qnode) const
+{
+    // Existing child, proportional to its visits
+    int total = 0;
+    for (int observation : qnode.Expanded())
+        total += qnode.Child(observation)->Value.GetCount() + 1;
+    if (total == 0)
+        return -1;
+    int visit = Random(total);
+    for (int observation : qnode.Expanded())
+    {
+        visit -= qnode.Child(observation)->Value.GetCount() + 1;
+        if (visit < 0)
+            return observation;
+    }
+    return -1;
+}
+
+void MCTS::AddRave(VNODE* vnode, int position, double totalReward)
+{
+    if (!Params.UseRave)
+        return;
+    const vector<double>& weights =
+        Amaf.At(History, position, Params.RaveDiscount);
+    for (int action = 0; action < Simulator.GetNumActions(); action++)
+        if (weights[action] > 0)
+            vnode->Child(action).AMAF.Add(totalReward, weights[action]);
 }
 
 VNODE* MCTS::ExpandNode(const STATE* state)
 {
     VNODE* vnode = VNODE::Create();
-    Simulator.set_belief_metainfo(vnode, Simulator);
+    if (MetaPrototype)
+        vnode->Beliefs().set_metainfo_prototype(MetaPrototype);
+    else
+        Simulator.set_belief_metainfo(vnode, Simulator);
+    if (Params.Deduplicate)
+        vnode->Beliefs().EnableDeduplication(Simulator);
     vnode->Value.Set(0, 0);
     Simulator.Prior(state, History, vnode, Status);
+    if (NumTreeActions > Simulator.GetNumActions())
+        PriorMacros(state, vnode);
 
     if (Params.Verbose >= 2)
     {
@@ -272,8 +967,57 @@ VNODE* MCTS::ExpandNode(const STATE* state)
     return vnode;
 }
 
+void MCTS::PriorMacros(const STATE* state, VNODE* vnode) const
+{
+    // Macros that do not start in state are ruled out like illegal actions
+    bool started = false;
+    for (int macro = 0; macro < Simulator.GetNumMacros(); macro++)
+    {
+        QNODE& qnode = vnode->Child(Simulator.GetNumActions() + macro);
+        if (state && Simulator.MacroAction(*state, macro) < 0)
+        {
+            qnode.Value.Set(+LargeInteger, -Infinity);
+            qnode.AMAF.Set(+LargeInteger, -Infinity);
+        }
+        else
+        {
+            qnode.Value.Set(0, 0);
+            qnode.AMAF.Set(0, 0);
+            started = true;
+        }
+    }
+
+    // The covered primitives stay when no macro can take their place
+    if (Params.MacroActions != MACRO_ONLY || !started)
+        return;
+    for (int action = 0; action < Simulator.GetNumActions(); action++)
+    {
+        if (!Simulator.MacroCovers(action))
+            continue;
+        QNODE& qnode = vnode->Child(action);
+        qnode.Value.Set(+LargeInteger, -Infinity);
+        qnode.AMAF.Set(+LargeInteger, -Infinity);
+    }
+}
+
 void MCTS::AddSample(VNODE* node, const STATE& state)
 {
+    // Reservoir sampling: after n visits each of them is stored with
+    // probability MaxNodeSamples / n
+    if (Params.MaxNodeSamples > 0)
+    {
+        int offered = node->Beliefs().Offer();
+        if (offered > Params.MaxNodeSamples)
+        {
+            int particle = Random(offered);
+            if (particle >= Params.MaxNodeSamples)
+                return;
+            node->Beliefs().RemoveParticle(particle, Simulator);
+        }
+    }
+
+    if (node->Beliefs().AddCount(state))
+        return;
     STATE* sample = Simulator.Copy(state);
     node->Beliefs().AddSample(sample);
     if (Params.Verbose >= 2)
@@ -283,7 +1027,8 @@ void MCTS::AddSample(VNODE* node, const STATE& state)
     }
 }
 
-int MCTS::GreedyUCB(VNODE* vnode, bool ucb) const
+int MCTS::GreedyUCB(VNODE* vnode, bool ucb, int exclude,
+    const STATE* state) const
 {
     static vector<int> besta;
     besta.clear();
@@ -296,6 +1041,8 @@ int MCTS::GreedyUCB(VNODE* vnode, bool ucb) const
     if (Params.use_shield && TreeDepth == 0) {
         for (int action : legal_actions)
         {
+            if (action == exclude || !MacroStarts(state, action))
+                continue;
             double q, alphaq;
             int n, alphan;
 
@@ -312,12 +1059,12 @@ int MCTS::GreedyUCB(VNODE* vnode, bool ucb) const
 
             if (hasalpha && n > 0)
             {
-                Simulator.AlphaValue(qnode, alphaq, alphan);
+                Simulator.AlphaValue(qnode, action, alphaq, alphan);
                 q = (n * q + alphan * alphaq) / (n + alphan);
             }
 
             if (ucb)
-                q += FastUCB(N, n, logN);
+                q += SelectionBonus(qnode.Value, N, n, logN);
 
             if (q >= bestq)
             {
@@ -329,8 +1076,17 @@ int MCTS::GreedyUCB(VNODE* vnode, bool ucb) const
         }
     }
     else {
-        for (int action = 0; action < Simulator.GetNumActions(); action++)
+        // Below the root the node's own shield, macros are not shielded
+        uint64_t shield = ~0ULL;
+        if (Params.use_shield && Params.ShieldTree)
+            shield = ShieldMask(vnode);
+        for (int action = 0; action < NumTreeActions; action++)
         {
+            if (action == exclude || !MacroStarts(state, action))
+                continue;
+            if (action < Simulator.GetNumActions()
+                && !(shield & (1ULL << action)))
+                continue;
             double q, alphaq;
             int n, alphan;
 
@@ -347,12 +1103,12 @@ int MCTS::GreedyUCB(VNODE* vnode, bool ucb) const
 
             if (hasalpha && n > 0)
             {
-                Simulator.AlphaValue(qnode, alphaq, alphan);
+                Simulator.AlphaValue(qnode, action, alphaq, alphan);
                 q = (n * q + alphan * alphaq) / (n + alphan);
             }
 
             if (ucb)
-                q += FastUCB(N, n, logN);
+                q += SelectionBonus(qnode.Value, N, n, logN);
 
             if (q >= bestq)
             {
@@ -364,41 +1120,122 @@ int MCTS::GreedyUCB(VNODE* vnode, bool ucb) const
         }
     }
 
+    // Every candidate was a macro that does not start in state
+    if (besta.empty() && state)
+        return GreedyUCB(vnode, ucb, exclude);
     assert(!besta.empty());
     return besta[Random(besta.size())];
 }
 
-double MCTS::Rollout(STATE& state)
+bool MCTS::MacroStarts(const STATE* state, int action) const
+{
+    // An inapplicable macro is illegal for the simulation of state
+    int macro = action - Simulator.GetNumActions();
+    return !state || macro < 0 || Simulator.MacroAction(*state, macro) >= 0;
+}
+
+uint64_t MCTS::ShieldMask(VNODE* vnode) const
+{
+    // The shield reads the belief metainfo, which would give away the
+    // hidden state of a node with a handful of particles. Until the node
+    // holds ShieldParticles of them every action is allowed, then its mask
+    // is computed once.
+    assert(Simulator.GetNumActions() <= 64);
+    if (vnode->ShieldMask)
+        return vnode->ShieldMask;
+    uint64_t all = Simulator.GetNumActions() == 64
+        ? ~0ULL : (1ULL << Simulator.GetNumActions()) - 1;
+    if (vnode->Beliefs().GetTotalCount() < Params.ShieldParticles)
+        return all;
+
+    static vector<int> legal;
+    legal.clear();
+    Simulator.pre_shield(vnode->Beliefs(), legal);
+    uint64_t mask = 0;
+    for (int action : legal)
+        mask |= 1ULL << action;
+    vnode->ShieldMask = mask ? mask : all;
+    return vnode->ShieldMask;
+}
+
+bool MCTS::NeedsParticles(const VNODE* vnode) const
+{
+    return (Params.use_shield && Params.ShieldTree && !vnode->ShieldMask)
+        || (Simulator.HasRulePrior() && !vnode->RulesApplied);
+}
+
+void MCTS::AddRulePrior(VNODE* vnode)
+{
+    // Read from the node's belief, like the shield, once it holds enough
+    // particles not to give away the hidden state
+    if (!Simulator.HasRulePrior() || vnode->RulesApplied
+        || vnode->Beliefs().GetTotalCount() < Params.ShieldParticles)
+        return;
+    Simulator.RulePrior(vnode->Beliefs(), vnode);
+    vnode->RulesApplied = true;
+}
+
+double MCTS::Rollout(STATE& treeState)
 {
     Status.Phase = SIMULATOR::STATUS::ROLLOUT;
     if (Params.Verbose >= 3)
         cout << "Starting rollout" << endl;
 
+    // The rollout model works on its own copy of the state
+    const SIMULATOR& model = RolloutSimulator ? *RolloutSimulator : Simulator;
+    STATE* converted = RolloutSimulator
+        ? RolloutSimulator->ConvertState(treeState) : 0;
+    STATE& state = converted ? *converted : treeState;
+
     double totalReward = 0.0;
     double discount = 1.0;
     bool terminal = false;
+    int maxSteps = Params.MaxDepth - TreeDepth;
+    if (Params.RolloutLength > 0)
+        maxSteps = min(maxSteps, Params.RolloutLength);
+    bool controlVariate = Params.ControlVariate != 0
+        && model.HasExpectedReward();
     int numSteps;
-    for (numSteps = 0; numSteps + TreeDepth < Params.MaxDepth && !terminal; ++numSteps)
+    for (numSteps = 0; numSteps < maxSteps && !terminal; ++numSteps)
     {
+        // Stop once the rest of the rollout can change the return by
+        // less than the tolerance
+        if (discount * Simulator.GetRewardRange() < Params.RolloutTolerance)
+            break;
+
         SIMULATOR::observation_t observation;
-        double reward;
+        double reward, expected = 0;
 
-        int action = Simulator.SelectRandom(state, History, Status);
-        terminal = Simulator.Step(state, action, observation, reward);
+        int action = model.SelectRandom(state, History, Status);
+        if (controlVariate)
+            expected = model.ExpectedReward(state, action);
+        terminal = model.Step(state, action, observation, reward);
         History.Add(action, observation);
 
         if (Params.Verbose >= 4)
         {
-            Simulator.DisplayAction(action, cout);
-            Simulator.DisplayObservation(state, observation, cout);
-            Simulator.DisplayReward(reward, cout);
-            Simulator.DisplayState(state, cout);
+            model.DisplayAction(action, cout);
+            model.DisplayObservation(state, observation, cout);
+            model.DisplayReward(reward, cout);
+            model.DisplayState(state, cout);
         }
 
+        // The reward's deviation from its expectation has mean zero, so
+        // taking out a multiple of it leaves the return unbiased
+        if (controlVariate)
+            reward -= Params.ControlVariate * (reward - expected);
         totalReward += reward * discount;
-        discount *= Simulator.GetDiscount();
+        discount *= model.GetDiscount();
     }
 
+    // Truncated before the horizon, the domain values the rest
+    if (!terminal && numSteps + TreeDepth < Params.MaxDepth)
+        totalReward += discount
+            * model.EvaluateLeaf(state, History, TreeDepth + numSteps);
+
+    if (converted)
+        model.FreeState(converted);
+
     StatRolloutDepth.Add(numSteps);
     if (Params.Verbose >= 3)
         cout << "Ending rollout after " << numSteps
@@ -429,12 +1266,70 @@ void MCTS::AddTransforms(VNODE* root, BELIEF_STATE& beliefs)
     }
 }
 
+void MCTS::RefillBelief(BELIEF_STATE& beliefs)
+{
+    // Alternate two proposals until the target size is reached: states from
+    // the previous root belief that reproduce the real observation when
+    // stepped (rejection sampling), and LocalMove transformations
+    if (Root->Beliefs().Empty())
+        return;
+
+    int action = History.Back().Action;
+    SIMULATOR::observation_t observation = History.Back().Observation;
+    int missing = Params.RefillTarget - beliefs.GetTotalCount();
+    int maxAttempts = missing * Params.RefillAttempts;
+    int rejectionTried = 0, rejectionAdded = 0;
+    int localTried = 0, localAdded = 0;
+
+    for (int attempt = 0; attempt < maxAttempts
+        && beliefs.GetTotalCount() < Params.RefillTarget; ++attempt)
+    {
+        if (attempt % 2 == 0 || !Params.UseTransforms)
+        {
+            SIMULATOR::observation_t stepObs;
+            double stepReward;
+            STATE* state = Root->Beliefs().CreateSample(Simulator);
+            bool terminal = Simulator.Step(*state, action, stepObs, stepReward);
+            rejectionTried++;
+            if (!terminal && stepObs == observation)
+            {
+                beliefs.AddSample(state);
+                rejectionAdded++;
+                StatRejectionAccept.Add(1);
+            }
+            else
+            {
+                Simulator.FreeState(state);
+                StatRejectionAccept.Add(0);
+            }
+        }
+        else
+        {
+            STATE* state = CreateTransform();
+            localTried++;
+            if (state)
+            {
+                beliefs.AddSample(state);
+                localAdded++;
+            }
+            StatLocalMoveAccept.Add(state ? 1 : 0);
+        }
+    }
+
+    if (Params.Verbose >= 1)
+    {
+        cout << "Refilled belief to " << beliefs.GetTotalCount() << " states: "
+            << rejectionAdded << "/" << rejectionTried << " rejection samples, "
+            << localAdded << "/" << localTried << " local moves accepted" << endl;
+    }
+}
+
 STATE* MCTS::CreateTransform() const
 {
     SIMULATOR::observation_t stepObs;
     double stepReward;
 
-    STATE* state = Root->Beliefs().CreateSample(Simulator);
+    STATE* state = CreateRootSample();
     Simulator.Step(*state, History.Back().Action, stepObs, stepReward);
     if (Simulator.LocalMove(*state, History, stepObs, Status))
         return state;
@@ -442,6 +1337,189 @@ STATE* MCTS::CreateTransform() const
     return 0;
 }
 
+void MCTS::Resample(BELIEF_STATE& beliefs)
+{
+    double probability = FilterParticles(Root->Beliefs(),
+        History.Back().Action, History.Back().Observation, true,
+        Params.NumStartStates, beliefs);
+
+    if (Params.Verbose >= 1)
+        cout << "Observation probability " << probability << endl;
+}
+
+double MCTS::FilterParticles(const BELIEF_STATE& from, int action,
+    SIMULATOR::observation_t observation, bool condition, int numParticles,
+    BELIEF_STATE& to) const
+{
+    // Sequential importance resampling: step every particle with action,
+    // weight it by the likelihood of observation (if condition) and draw
+    // numParticles particles by systematic resampling. Returns the
+    // probability of observation under the stepped particles.
+    vector<STATE*> particles;
+    vector<double> cumulative;
+    double totalWeight = 0;
+    for (int i = 0; i < from.GetNumSamples(); ++i)
+    {
+        STATE* state = Simulator.Copy(*from.GetSample(i));
+        SIMULATOR::observation_t stepObs;
+        double stepReward;
+        bool terminal = Simulator.Step(*state, action, stepObs, stepReward);
+        double weight = terminal ? 0 : from.GetCount(i);
+        if (condition && weight > 0)
+            weight *= Simulator.ObservationProbability(*state, action,
+                observation);
+        if (weight <= 0)
+        {
+            Simulator.FreeState(state);
+            continue;
+        }
+
+        if (condition && stepObs != observation)
+            Simulator.SetObservation(*state, action, stepObs, observation);
+        totalWeight += weight;
+        particles.push_back(state);
+        cumulative.push_back(totalWeight);
+    }
+
+    if (totalWeight > 0)
+    {
+        double step = totalWeight / numParticles;
+        double u = RandomDouble(0, step);
+        vector<int> draws(particles.size(), 0);
+        int j = 0;
+        for (int i = 0; i < numParticles; ++i, u += step)
+        {
+            while (j + 1 < (int) particles.size() && cumulative[j] < u)
+                ++j;
+            draws[j]++;
+        }
+        for (j = 0; j < (int) particles.size(); ++j)
+        {
+            if (draws[j] > 0)
+            {
+                to.AddSample(particles[j], draws[j]);
+                particles[j] = 0;
+            }
+        }
+    }
+
+    for (STATE* state : particles)
+        if (state)
+            Simulator.FreeState(state);
+    return from.GetTotalCount() > 0 ? totalWeight / from.GetTotalCount() : 0;
+}
+
+VNODE* MCTS::FindTransposition(const STATE& state)
+{
+    // The depth is part of the signature, so the shared nodes form a DAG
+    uint64_t signature = History.GetKey();
+    signature ^= Mix64(Simulator.ObservedHash(state) + TreeDepth + 1);
+
+    VNODE*& vnode = TranspositionTable[signature];
+    if (vnode)
+    {
+        vnode->AddReference();
+        return vnode;
+    }
+    vnode = ExpandNode(&state);
+    vnode->Signature = signature;
+    return vnode;
+}
+
+void MCTS::FreeTree()
+{
+    VNODE::Free(Root, Simulator);
+    TranspositionTable.clear();
+}
+
+int MCTS::EvictLeaves(int target)
+{
+    // A leaf's returns are already in its parent QNODE's statistics, so
+    // freeing it loses only its own value and particles. Nodes at depth one
+    // are kept, their particles are the next belief.
+    // A shared leaf is only released from one parent at a time.
+    static vector<LEAF> leaves;
+    int allocated = VNODE::GetNumAllocated();
+    while (VNODE::GetNumAllocated() > target)
+    {
+        leaves.clear();
+        Visited.clear();
+        CollectLeaves(Root, 0, leaves);
+        if (leaves.empty())
+            break;
+
+        int n = min<int>(VNODE::GetNumAllocated() - target, leaves.size());
+        nth_element(leaves.begin(), leaves.begin() + n, leaves.end(),
+            [](const LEAF& a, const LEAF& b) { return a.Count < b.Count; });
+        for (int i = 0; i < n; ++i)
+        {
+            VNODE*& leaf = leaves[i].Parent->Child(leaves[i].Observation);
+            if (UseTranspositions && leaf->GetReferences() == 1)
+                TranspositionTable.erase(leaf->Signature);
+            VNODE::Free(leaf, Simulator);
+            leaf = 0;
+            leaves[i].Parent->RemoveExpanded(leaves[i].Observation);
+        }
+    }
+    return allocated - VNODE::GetNumAllocated();
+}
+
+void MCTS::CollectLeaves(VNODE* vnode, int depth, vector<LEAF>& leaves)
+{
+    for (int action = 0; action < NumTreeActions; action++)
+    {
+        QNODE& qnode = vnode->Child(action);
+        for (int observation : qnode.Expanded())
+        {
+            VNODE* child = qnode.Child(observation);
+            // Walk shared nodes once
+            if (child->GetReferences() > 1 && !Visited.insert(child).second)
+                continue;
+            bool leaf = true;
+            for (int a = 0; a < NumTreeActions && leaf; a++)
+                leaf = child->Child(a).Expanded().empty();
+            if (!leaf)
+                CollectLeaves(child, depth + 1, leaves);
+            else if (depth + 1 >= 2)
+                leaves.push_back({ child->Value.GetCount(), &qnode, observation });
+        }
+    }
+}
+
+void MCTS::AddBranching(const VNODE* vnode)
+{
+    for (int action = 0; action < NumTreeActions; action++)
+    {
+        const QNODE& qnode = vnode->Child(action);
+        if (qnode.Expanded().empty())
+            continue;
+        StatBranching.Add(qnode.Expanded().size());
+        for (int observation : qnode.Expanded())
+        {
+            const VNODE* child = qnode.Child(observation);
+            if (child->GetReferences() > 1 && !Visited.insert(child).second)
+                continue;
+            AddBranching(child);
+        }
+    }
+}
+
+STATE* MCTS::CreateRootSample() const
+{
+    if (ExactBelief)
+        return Simulator.CreateSample(*ExactBelief);
+    return Root->Beliefs().CreateSample(Simulator);
+}
+
+void MCTS::RefillExactBelief(VNODE* root)
+{
+    // Particles are only kept for the shield, the trace and the displays;
+    // the metainfo is the exact belief rather than their histogram
+    for (int i = 0; i < Params.NumStartStates; i++)
+        root->Beliefs().AddSample(Simulator.CreateSample(*ExactBelief));
+    root->Beliefs().set_metainfo(*ExactBelief, Simulator);
+}
+
 double MCTS::UCB[UCB_N][UCB_n];
 bool MCTS::InitialisedFastUCB = true;
 
@@ -469,11 +1547,34 @@ inline double MCTS::FastUCB(int N, int n, double logN) const
         return Params.ExplorationConstant * sqrt(logN / n);
 }
 
+// Optimism added to an action's value during selection: the UCB1 term,
+// the variance aware UCB-V term, or a draw from the Gaussian posterior of
+// the mean (Thompson sampling), with one pseudo-return of variance
+// ExplorationConstant^2 so unexplored spread is not mistaken for certainty
+double MCTS::SelectionBonus(const VALUE<int>& value, int N, int n,
+    double logN) const
+{
+    if (Params.SelectionRule == SELECT_UCB1)
+        return FastUCB(N, n, logN);
+
+    if (n == 0)
+        return Infinity;
+
+    double range = Params.ExplorationConstant;
+    if (Params.SelectionRule == SELECT_UCBV)
+        return sqrt(2.0 * value.GetVariance() * logN / n)
+            + 3.0 * range * logN / n;
+
+    double variance = (n * value.GetVariance() + range * range) / (n + 1);
+    return sqrt(variance / n) * RandomNormal();
+}
+
 void MCTS::ClearStatistics()
 {
     StatTreeDepth.Clear();
     StatRolloutDepth.Clear();
     StatTotalReward.Clear();
+    StatMacroLength.Clear();
 }
 
 void MCTS::DisplayStatistics(ostream& ostr) const
@@ -483,13 +1584,38 @@ void MCTS::DisplayStatistics(ostream& ostr) const
         StatTreeDepth.Print("Tree depth", ostr);
         StatRolloutDepth.Print("Rollout depth", ostr);
         StatTotalReward.Print("Total reward", ostr);
+        if (StatRejectionAccept.GetCount() > 0)
+            StatRejectionAccept.Print("Refill rejection acceptance", ostr);
+        if (StatLocalMoveAccept.GetCount() > 0)
+            StatLocalMoveAccept.Print("Refill local move acceptance", ostr);
+        if (Params.WideningConstant > 0)
+            StatBranching.Print("Observation branching", ostr);
+        if (Params.MaxTreeNodes > 0)
+        {
+            ostr << "Evicted " << Evictions << " nodes" << endl;
+            StatEvictions.Print("Evictions per decision", ostr);
+        }
+        StatRootError.Print("Root value standard error", ostr);
+        if (NumTreeActions > Simulator.GetNumActions())
+            StatMacroLength.Print("Macro length", ostr);
+        if (Params.SmcSearch)
+        {
+            ostr << "SMC tree of " << SmcNodes << " nodes, " << SmcPooled
+                << " rare observations pooled" << endl;
+            StatSmcNodes.Print("SMC nodes per decision", ostr);
+        }
+        if (Params.StopInterval > 0)
+        {
+            ostr << "Stopped after " << Simulations << " simulations" << endl;
+            StatSimulations.Print("Simulations per decision", ostr);
+        }
     }
 
     if (Params.Verbose >= 2)
     {
-        ostr << "Policy after " << Params.NumSimulations << " simulations" << endl;
+        ostr << "Policy after " << Simulations << " simulations" << endl;
         DisplayPolicy(6, ostr);
-        ostr << "Values after " << Params.NumSimulations << " simulations" << endl;
+        ostr << "Values after " << Simulations << " simulations" << endl;
         DisplayValue(6, ostr);
     }
 }
@@ -512,6 +1638,7 @@ void MCTS::DisplayPolicy(int depth, ostream& ostr) const
 
 void MCTS::UnitTest()
 {
+    UnitTestReservoir();
     UnitTestGreedy();
     UnitTestUCB();
     UnitTestRollout();
@@ -519,6 +1646,50 @@ void MCTS::UnitTest()
         UnitTestSearch(depth);
 }
 
+void MCTS::UnitTestReservoir()
+{
+    TEST_SIMULATOR testSimulator(2, 2, 0);
+    const int cap = 10, numOffered = 100, numTrials = 2000;
+
+    for (bool deduplicate : { false, true })
+    {
+        PARAMS params;
+        params.MaxNodeSamples = cap;
+        params.Deduplicate = deduplicate;
+        MCTS mcts(testSimulator, params);
+
+        // The node keeps min(offered, cap) particles, duplicates included
+        VNODE* vnode = mcts.ExpandNode(0);
+        STATE* state = testSimulator.CreateStartState();
+        for (int i = 0; i < numOffered; ++i)
+        {
+            safe_cast<TEST_STATE*>(state)->Depth = i % 7;
+            mcts.AddSample(vnode, *state);
+            assert(vnode->Beliefs().GetTotalCount() == min(i + 1, cap));
+        }
+
+        // Each offered sample is kept with probability cap / offered
+        int kept = 0;
+        for (int trial = 0; trial < numTrials; ++trial)
+        {
+            VNODE* node = mcts.ExpandNode(0);
+            for (int i = 0; i < numOffered; ++i)
+            {
+                safe_cast<TEST_STATE*>(state)->Depth = i;
+                mcts.AddSample(node, *state);
+            }
+            const BELIEF_STATE& beliefs = node->Beliefs();
+            for (int j = 0; j < beliefs.GetNumSamples(); ++j)
+                if (safe_cast<const TEST_STATE*>(beliefs.GetSample(j))->Depth == 0)
+                    kept += beliefs.GetCount(j);
+            VNODE::Free(node, testSimulator);
+        }
+        assert(Near(kept, numTrials * cap / numOffered, 60));
+        testSimulator.FreeState(state);
+        VNODE::Free(vnode, testSimulator);
+    }
+}
+
 void MCTS::UnitTestGreedy()
 {
     TEST_SIMULATOR testSimulator(5, 5, 0);
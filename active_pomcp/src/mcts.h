@@ -3,12 +3,30 @@
 
 #include "simulator.h"
 #include "node.h"
+#include "node_smc.h"
 #include "statistic.h"
+#include "amaf.h"
+#include <unordered_map>
+#include <unordered_set>
 
 class MCTS
 {
 public:
 
+    enum
+    {
+        SELECT_UCB1,
+        SELECT_UCBV,
+        SELECT_THOMPSON
+    };
+
+    enum
+    {
+        MACRO_NONE,
+        MACRO_MIXED,    // macros next to all the primitive actions
+        MACRO_ONLY      // macros in place of the primitives they cover
+    };
+
     struct PARAMS
     {
         PARAMS();
@@ -25,18 +43,57 @@ public:
         bool UseRave;
         double RaveDiscount;
         double RaveConstant;
+        bool RaveFirstOccurrence;
         bool DisableTree;
         bool use_shield;
+        bool ShieldTree;
+        int ShieldParticles;
+        bool ExactBelief;
+        bool UseParticleFilter;
+        int RefillTarget;
+        int RefillAttempts;
+        bool Deduplicate;
+        int MaxNodeSamples;
+        int SampleDepth;
+        int MaxTreeNodes;
+        bool Transpositions;
+        double WideningConstant;
+        double WideningExponent;
+        bool AbstractObservations;
+        int AbstractionDepth;
+        bool OpenLoop;
+        int RolloutLength;
+        double RolloutTolerance;
+        int StopInterval;
+        double StopTolerance;
+        int SelectionRule;
+        bool PairedRollouts;
+        double ControlVariate;
+        int MacroActions;
+        int MacroLength;
+        bool SmcSearch;
+        int SmcParticles;
+        double SmcPoolProbability;
     };
 
     MCTS(const SIMULATOR& simulator, const PARAMS& params);
     ~MCTS();
 
     int SelectAction();
+    void SetNumSimulations(int numSimulations)
+    {
+        Params.NumSimulations = numSimulations;
+    }
+    // Cheaper model for rollouts only, the tree keeps the exact simulator
+    void SetRolloutSimulator(const SIMULATOR* simulator)
+    {
+        RolloutSimulator = simulator;
+    }
     bool Update(int action, SIMULATOR::observation_t observation, double reward);
 
     void UCTSearch();
     void RolloutSearch();
+    void SmcSearch();
 
     double Rollout(STATE& state);
 
@@ -49,6 +106,9 @@ public:
     void DisplayPolicy(int depth, std::ostream& ostr) const;
 
     const VNODE * const GetRoot() const { return Root; }
+    // Gap between the two best action values of the subtree the last
+    // Update stepped into, from the search before it; -1 if none was kept
+    double GetRootGap() const { return RootGap; }
 
     static void UnitTest();
     static void InitFastUCB(double exploration);
@@ -56,28 +116,100 @@ public:
 private:
 
     const SIMULATOR& Simulator;
+    const SIMULATOR* RolloutSimulator;
+    int NumTreeActions;             // primitive actions, then macros
     int TreeDepth, PeakTreeDepth;
     PARAMS Params;
     VNODE* Root;
     HISTORY History;
     SIMULATOR::STATUS Status;
 
+    // Exact root belief, owned by the search (null unless Params.ExactBelief)
+    BELIEF_META_INFO* ExactBelief;
+    // Empty domain metainfo shared by all nodes, each node clones it only
+    // when its metainfo is first queried
+    BELIEF_META_INFO* MetaPrototype;
+
     STATISTIC StatTreeDepth;
     STATISTIC StatRolloutDepth;
     STATISTIC StatTotalReward;
+    STATISTIC StatRejectionAccept; // over the whole episode
+    STATISTIC StatLocalMoveAccept;
+    // Nodes shared by histories with the same signature (Params.Transpositions)
+    std::unordered_map<uint64_t, VNODE*> TranspositionTable;
+    std::unordered_set<const VNODE*> Visited;
+    bool UseTranspositions;
+
+    STATISTIC StatBranching;       // child nodes per expanded QNODE
+    STATISTIC StatEvictions;       // per decision, over the whole episode
+    int Evictions;                 // in the last search
+    int EvictionFloor;             // no eviction below, after one fell short
+    STATISTIC StatSimulations;     // per decision, over the whole episode
+    STATISTIC StatRootError;       // mean root value std error, per decision
+    STATISTIC StatMacroLength;     // primitive steps per macro edge
+    STATISTIC StatSmcNodes;        // per decision, over the whole episode
+    SMC_VNODE* SmcRoot;            // during SmcSearch only
+    int SmcNodes, SmcPooled;       // in the last search
+    int Simulations;               // in the last search
+    double RootMinReturn, RootMaxReturn; // in the last search
+    double RootGap;                // of the subtree kept by the last Update
+    std::mt19937 PairSeeds;        // seeds of the paired simulations
 
     std::vector<int> legal_actions;
-
-    int GreedyUCB(VNODE* vnode, bool ucb) const;
+    AMAF_WEIGHTS Amaf;
+
+    // With state, the macros that do not start in it are skipped
+    int GreedyUCB(VNODE* vnode, bool ucb, int exclude = -1,
+        const STATE* state = 0) const;
+    bool MacroStarts(const STATE* state, int action) const;
+    uint64_t ShieldMask(VNODE* vnode) const;
+    bool NeedsParticles(const VNODE* vnode) const;
+    void AddRulePrior(VNODE* vnode);
     int SelectRandom() const;
-    double SimulateV(STATE& state, VNODE* vnode);
+    int RunSimulation(STATE* state, int action, int historyDepth);
+    void AddRootError();
+    double SimulateV(STATE& state, VNODE* vnode, int action = -1);
     double SimulateQ(STATE& state, QNODE& qnode, int action);
-    void AddRave(VNODE* vnode, double totalReward);
+    double SimulateMacro(STATE& state, QNODE& qnode, int macro);
+    void AddRootStep(int action, SIMULATOR::observation_t observation,
+        const STATE& state);
+    int MacroRootAction(int macro) const;
+    void ShieldMacros();
+    void AddRave(VNODE* vnode, int position, double totalReward);
     VNODE* ExpandNode(const STATE* state);
+    void PriorMacros(const STATE* state, VNODE* vnode) const;
     void AddSample(VNODE* node, const STATE& state);
     void AddTransforms(VNODE* root, BELIEF_STATE& beliefs);
+    void RefillBelief(BELIEF_STATE& beliefs);
     STATE* CreateTransform() const;
+    STATE* CreateRootSample() const;
+    void RefillExactBelief(VNODE* root);
     void Resample(BELIEF_STATE& beliefs);
+    double FilterParticles(const BELIEF_STATE& from, int action,
+        SIMULATOR::observation_t observation, bool condition,
+        int numParticles, BELIEF_STATE& to) const;
+    double SimulateSmcV(SMC_VNODE* vnode);
+    double SimulateSmcQ(STATE& state, SMC_VNODE* vnode, int action);
+    SMC_VNODE* SmcChild(SMC_VNODE* vnode, int action,
+        SIMULATOR::observation_t observation);
+    void SmcPrior(SMC_VNODE* vnode) const;
+    int SmcGreedy(const SMC_VNODE* vnode, bool ucb) const;
+    VNODE* FindTransposition(const STATE& state);
+    void FreeTree();
+    int EvictLeaves(int target);
+    struct LEAF
+    {
+        int Count;
+        QNODE* Parent;
+        int Observation;
+    };
+    void CollectLeaves(VNODE* vnode, int depth, std::vector<LEAF>& leaves);
+    int SelectWidened(const QNODE& qnode) const;
+    SIMULATOR::observation_t BranchObservation(
+        SIMULATOR::observation_t observation, int depth) const;
+    void AddBranching(const VNODE* vnode);
+    bool RootSettled(int numChecks) const;
+    double ValueGap(const VNODE* vnode) const;
 
     // Fast lookup table for UCB
     static const int UCB_N = 10000, UCB_n = 100;
@@ -85,7 +217,10 @@ private:
     static bool InitialisedFastUCB;
 
     double FastUCB(int N, int n, double logN) const;
+    double SelectionBonus(const VALUE<int>& value, int N, int n,
+        double logN) const;
 
+    static void UnitTestReservoir();
     static void UnitTestGreedy();
     static void UnitTestUCB();
     static void UnitTestRollout();
@@ -154,6 +154,7 @@ void MCTS_LAZY::UCTSearch()
         }
         TreeDepth = 0;
         PeakTreeDepth = 0;
+        Amaf.Reset(Simulator.GetNumActions(), Params.RaveFirstOccurrence);
         double totalReward = SimulateV(*state, Root);
         StatTotalReward.Add(totalReward);
         StatTreeDepth.Add(PeakTreeDepth);
@@ -181,9 +182,10 @@ double MCTS_LAZY::SimulateV(STATE& state, VNODE_LAZY* vnode)
         AddSample(vnode, state);
 
     QNODE_LAZY& qnode = vnode->Child(action);
+    int position = History.Size();
     double totalReward = SimulateQ(state, qnode, action);
     vnode->Value.Add(totalReward);
-    AddRave(vnode, totalReward);
+    AddRave(vnode, position, totalReward);
     return totalReward;
 }
 
@@ -194,7 +196,7 @@ double MCTS_LAZY::SimulateQ(STATE& state, QNODE_LAZY& qnode, int action)
 
     /* DISABLED
     if (Simulator.HasAlpha())
-        Simulator.UpdateAlpha(qnode, state);
+        Simulator.UpdateAlpha(qnode, action, state);
     */
 
     bool terminal = Simulator.Step(state, action, observation, immediateReward);
@@ -228,15 +230,15 @@ double MCTS_LAZY::SimulateQ(STATE& state, QNODE_LAZY& qnode, int action)
     return totalReward;
 }
 
-void MCTS_LAZY::AddRave(VNODE_LAZY* vnode, double totalReward)
+void MCTS_LAZY::AddRave(VNODE_LAZY* vnode, int position, double totalReward)
 {
-    double totalDiscount = 1.0;
-    for (int t = TreeDepth; t < History.Size(); ++t)
-    {
-        QNODE_LAZY& qnode = vnode->Child(History[t].Action);
-        //qnode.AMAF.Add(totalReward, totalDiscount);
-        totalDiscount *= Params.RaveDiscount;
-    }
+    if (!Params.UseRave)
+        return;
+    const vector<double>& weights =
+        Amaf.At(History, position, Params.RaveDiscount);
+    for (int action = 0; action < Simulator.GetNumActions(); action++)
+        if (weights[action] > 0)
+            vnode->Child(action).AMAF.Add(totalReward, weights[action]);
 }
 
 VNODE_LAZY* MCTS_LAZY::ExpandNode(const STATE* state)
@@ -287,7 +289,6 @@ int MCTS_LAZY::GreedyUCB(VNODE_LAZY* vnode, bool ucb) const
             q = qnode.Value.GetValue();
             n = qnode.Value.GetCount();
 
-            /*
             if (Params.UseRave && qnode.AMAF.GetCount() > 0)
             {
                 double n2 = qnode.AMAF.GetCount();
@@ -295,15 +296,16 @@ int MCTS_LAZY::GreedyUCB(VNODE_LAZY* vnode, bool ucb) const
                 q = (1.0 - beta) * q + beta * qnode.AMAF.GetValue();
             }
 
+            /*
             if (hasalpha && n > 0)
             {
-                Simulator.AlphaValue(qnode, alphaq, alphan);
+                Simulator.AlphaValue(qnode, action, alphaq, alphan);
                 q = (n * q + alphan * alphaq) / (n + alphan);
             }
             */
 
             if (ucb)
-                q += FastUCB(N, n, logN);
+                q += SelectionBonus(qnode.Value, N, n, logN);
 
             if (q >= bestq)
             {
@@ -324,25 +326,23 @@ int MCTS_LAZY::GreedyUCB(VNODE_LAZY* vnode, bool ucb) const
             q = qnode.Value.GetValue();
             n = qnode.Value.GetCount();
 
-            /*
             if (Params.UseRave && qnode.AMAF.GetCount() > 0)
             {
                 double n2 = qnode.AMAF.GetCount();
                 double beta = n2 / (n + n2 + Params.RaveConstant * n * n2);
                 q = (1.0 - beta) * q + beta * qnode.AMAF.GetValue();
             }
-            */
 
             /*
             if (hasalpha && n > 0)
             {
-                Simulator.AlphaValue(qnode, alphaq, alphan);
+                Simulator.AlphaValue(qnode, action, alphaq, alphan);
                 q = (n * q + alphan * alphaq) / (n + alphan);
             }
             */
 
             if (ucb)
-                q += FastUCB(N, n, logN);
+                q += SelectionBonus(qnode.Value, N, n, logN);
 
             if (q >= bestq)
             {
@@ -367,9 +367,17 @@ double MCTS_LAZY::Rollout(STATE& state)
     double totalReward = 0.0;
     double discount = 1.0;
     bool terminal = false;
+    int maxSteps = Params.MaxDepth - TreeDepth;
+    if (Params.RolloutLength > 0)
+        maxSteps = min(maxSteps, Params.RolloutLength);
     int numSteps;
-    for (numSteps = 0; numSteps + TreeDepth < Params.MaxDepth && !terminal; ++numSteps)
+    for (numSteps = 0; numSteps < maxSteps && !terminal; ++numSteps)
     {
+        // Stop once the rest of the rollout can change the return by
+        // less than the tolerance
+        if (discount * Simulator.GetRewardRange() < Params.RolloutTolerance)
+            break;
+
         SIMULATOR_LAZY::observation_t observation;
         double reward;
 
@@ -389,6 +397,11 @@ double MCTS_LAZY::Rollout(STATE& state)
         discount *= Simulator.GetDiscount();
     }
 
+    // Truncated before the horizon, the domain values the rest
+    if (!terminal && numSteps + TreeDepth < Params.MaxDepth)
+        totalReward += discount
+            * Simulator.EvaluateLeaf(state, History, TreeDepth + numSteps);
+
     StatRolloutDepth.Add(numSteps);
     if (Params.Verbose >= 3)
         cout << "Ending rollout after " << numSteps
@@ -459,6 +472,28 @@ inline double MCTS_LAZY::FastUCB(int N, int n, double logN) const
         return Params.ExplorationConstant * sqrt(logN / n);
 }
 
+// Optimism added to an action's value during selection: the UCB1 term,
+// the variance aware UCB-V term, or a draw from the Gaussian posterior of
+// the mean (Thompson sampling), with one pseudo-return of variance
+// ExplorationConstant^2 so unexplored spread is not mistaken for certainty
+double MCTS_LAZY::SelectionBonus(const VALUE<int>& value, int N, int n,
+    double logN) const
+{
+    if (Params.SelectionRule == MCTS::SELECT_UCB1)
+        return FastUCB(N, n, logN);
+
+    if (n == 0)
+        return Infinity;
+
+    double range = Params.ExplorationConstant;
+    if (Params.SelectionRule == MCTS::SELECT_UCBV)
+        return sqrt(2.0 * value.GetVariance() * logN / n)
+            + 3.0 * range * logN / n;
+
+    double variance = (n * value.GetVariance() + range * range) / (n + 1);
+    return sqrt(variance / n) * RandomNormal();
+}
+
 void MCTS_LAZY::ClearStatistics()
 {
     StatTreeDepth.Clear();
@@ -49,12 +49,13 @@ private:
     STATISTIC StatTotalReward;
 
     std::vector<int> legal_actions;
+    AMAF_WEIGHTS Amaf;
 
     int GreedyUCB(VNODE_LAZY* vnode, bool ucb) const;
     int SelectRandom() const;
     double SimulateV(STATE& state, VNODE_LAZY* vnode);
     double SimulateQ(STATE& state, QNODE_LAZY& qnode, int action);
-    void AddRave(VNODE_LAZY* vnode, double totalReward);
+    void AddRave(VNODE_LAZY* vnode, int position, double totalReward);
     VNODE_LAZY* ExpandNode(const STATE* state);
     void AddSample(VNODE_LAZY* node, const STATE& state);
     void AddTransforms(VNODE_LAZY* root, BELIEF_STATE& beliefs);
@@ -67,6 +68,8 @@ private:
     static bool InitialisedFastUCB;
 
     double FastUCB(int N, int n, double logN) const;
+    double SelectionBonus(const VALUE<int>& value, int N, int n,
+        double logN) const;
 
 };
 
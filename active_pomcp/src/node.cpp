@@ -14,7 +14,17 @@ void QNODE::Initialise()
     Children.resize(NumChildren);
     for (int observation = 0; observation < QNODE::NumChildren; observation++)
         Children[observation] = 0;
+    ExpandedObservations.clear();
     AlphaData.AlphaSum.clear();
+    AlphaData.Count = 0;
+}
+
+void QNODE::RemoveExpanded(int observation)
+{
+    auto i_obs = find(ExpandedObservations.begin(), ExpandedObservations.end(),
+        observation);
+    assert(i_obs != ExpandedObservations.end());
+    ExpandedObservations.erase(i_obs);
 }
 
 void QNODE::DisplayValue(HISTORY& history, int maxDepth, ostream& ostr) const
@@ -69,11 +79,17 @@ VNODE* VNODE::Create()
 {
     VNODE* vnode = VNodePool.Allocate();
     vnode->Initialise();
+    vnode->Signature = 0;
+    vnode->ShieldMask = 0;
+    vnode->RulesApplied = false;
+    vnode->References = 1;
     return vnode;
 }
 
 void VNODE::Free(VNODE* vnode, const SIMULATOR& simulator)
 {
+    if (--vnode->References > 0)
+        return;
     vnode->BeliefState.Free(simulator);
     VNodePool.Free(vnode);
     for (int action = 0; action < VNODE::NumChildren; action++)
@@ -17,6 +17,7 @@ struct ALPHA
 {
     std::vector<double> AlphaSum;
     double MaxValue;
+    int Count;
 };
 
 //-----------------------------------------------------------------------------
@@ -30,18 +31,21 @@ public:
     {
         Count = count;
         Total = value * count;
+        SumSquares = value * value * count;
     }
 
     void Add(double totalReward)
     {
         Count += 1.0;
         Total += totalReward;
+        SumSquares += totalReward * totalReward;
     }
 
     void Add(double totalReward, COUNT weight)
     {
         Count += weight;
         Total += totalReward * weight;
+        SumSquares += totalReward * totalReward * weight;
     }
 
     double GetValue() const
@@ -49,6 +53,16 @@ public:
         return Count == 0 ? Total : Total / Count;
     }
 
+    // Population variance of the returns, zero for the prior value
+    double GetVariance() const
+    {
+        if (Count == 0)
+            return 0;
+        double mean = Total / Count;
+        double variance = SumSquares / Count - mean * mean;
+        return variance > 0 ? variance : 0; // also rounding and -Infinity
+    }
+
     COUNT GetCount() const
     {
         return Count;
@@ -58,6 +72,7 @@ private:
 
     COUNT Count;
     double Total;
+    double SumSquares;
 };
 
 //-----------------------------------------------------------------------------
@@ -74,6 +89,11 @@ public:
     VNODE*& Child(int c) { return Children[c]; }
     VNODE* Child(int c) const { return Children[c]; }
     ALPHA& Alpha() { return AlphaData; }
+
+    // Observations with a child node, in creation order
+    const std::vector<int>& Expanded() const { return ExpandedObservations; }
+    void AddExpanded(int observation) { ExpandedObservations.push_back(observation); }
+    void RemoveExpanded(int observation);
     const ALPHA& Alpha() const { return AlphaData; }
 
     void DisplayValue(HISTORY& history, int maxDepth, std::ostream& ostr) const;
@@ -84,6 +104,7 @@ public:
 private:
 
     std::vector<VNODE*> Children;
+    std::vector<int> ExpandedObservations;
     ALPHA AlphaData;
 
 friend class VNODE;
@@ -96,11 +117,19 @@ class VNODE : public MEMORY_OBJECT
 public:
 
     VALUE<int> Value;
+    uint64_t Signature; // of the histories sharing this node (transpositions)
+    uint64_t ShieldMask; // actions the shield allows here, 0 until computed
+    bool RulesApplied;   // rule prior added to the children
 
     void Initialise();
     static VNODE* Create();
     static void Free(VNODE* vnode, const SIMULATOR& simulator);
     static void FreeAll();
+    static int GetNumAllocated() { return VNodePool.GetNumAllocated(); }
+
+    // Parents sharing this node, Free only releases it with the last one
+    void AddReference() { References++; }
+    int GetReferences() const { return References; }
 
     QNODE& Child(int c) { return Children[c]; }
     const QNODE& Child(int c) const { return Children[c]; }
@@ -118,6 +147,7 @@ private:
 
     std::vector<QNODE> Children;
     BELIEF_STATE BeliefState;
+    int References;
     static MEMORY_POOL<VNODE> VNodePool;
 };
 
@@ -10,6 +10,7 @@ void QNODE_LAZY::Initialise()
 {
     Children.clear();
     AlphaData.AlphaSum.clear();
+    AlphaData.Count = 0;
 }
 
 void QNODE_LAZY::DisplayValue(HISTORY& history, int maxDepth, ostream& ostr) const {
@@ -85,6 +86,7 @@ void VNODE_LAZY::SetChildren(int count, double value)
     {
         QNODE_LAZY& qnode = Children[action];
         qnode.Value.Set(count, value);
+        qnode.AMAF.Set(count, value);
     }
 }
 
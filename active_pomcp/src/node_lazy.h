@@ -14,6 +14,7 @@ class QNODE_LAZY
 public:
 
     VALUE<int> Value;
+    VALUE<double> AMAF;
 
     void Initialise();
 
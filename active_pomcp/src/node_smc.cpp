@@ -0,0 +1,145 @@
+#include "node_smc.h"
+#include "history.h"
+#include "utils.h"
+
+using namespace std;
+
+//-----------------------------------------------------------------------------
+
+int SMC_QNODE::NumChildren = 0;
+
+void SMC_QNODE::Initialise()
+{
+    assert(NumChildren);
+    Children.resize(NumChildren);
+    for (int observation = 0; observation < SMC_QNODE::NumChildren; observation++)
+        Children[observation] = 0;
+}
+
+void SMC_QNODE::DisplayValue(HISTORY& history, int maxDepth, ostream& ostr) const
+{
+    history.Display(ostr);
+    ostr << ": " << Value.GetValue() << " (" << Value.GetCount() << ")\n";
+    if (history.Size() >= maxDepth)
+        return;
+
+    for (int observation = 0; observation < NumChildren; observation++)
+    {
+        if (Children[observation])
+        {
+            history.Back().Observation = observation;
+            Children[observation]->DisplayValue(history, maxDepth, ostr);
+        }
+    }
+}
+
+void SMC_QNODE::DisplayPolicy(HISTORY& history, int maxDepth, ostream& ostr) const
+{
+    history.Display(ostr);
+    ostr << ": " << Value.GetValue() << " (" << Value.GetCount() << ")\n";
+    if (history.Size() >= maxDepth)
+        return;
+
+    for (int observation = 0; observation < NumChildren; observation++)
+    {
+        if (Children[observation])
+        {
+            history.Back().Observation = observation;
+            Children[observation]->DisplayPolicy(history, maxDepth, ostr);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+MEMORY_POOL<SMC_VNODE> SMC_VNODE::VNodePool;
+
+int SMC_VNODE::NumChildren = 0;
+
+void SMC_VNODE::Initialise()
+{
+    assert(NumChildren);
+    Children.resize(SMC_VNODE::NumChildren);
+    for (int action = 0; action < SMC_VNODE::NumChildren; action++)
+        Children[action].Initialise();
+    Value.Set(0, 0);
+    Probability.Set(0, 0);
+}
+
+SMC_VNODE* SMC_VNODE::Create()
+{
+    SMC_VNODE* vnode = VNodePool.Allocate();
+    vnode->Initialise();
+    return vnode;
+}
+
+void SMC_VNODE::Free(SMC_VNODE* vnode, const SIMULATOR& simulator)
+{
+    vnode->BeliefState.Free(simulator);
+    VNodePool.Free(vnode);
+    // The last observation slot holds the node pooled by the rare
+    // observations, the other slots may point to it
+    int pooled = SMC_QNODE::NumChildren - 1;
+    for (int action = 0; action < SMC_VNODE::NumChildren; action++)
+    {
+        SMC_QNODE& qnode = vnode->Child(action);
+        for (int observation = 0; observation < SMC_QNODE::NumChildren; observation++)
+        {
+            SMC_VNODE* child = qnode.Child(observation);
+            if (child && (observation == pooled || child != qnode.Child(pooled)))
+                Free(child, simulator);
+        }
+    }
+}
+
+void SMC_VNODE::FreeAll()
+{
+    VNodePool.DeleteAll();
+}
+
+void SMC_VNODE::SetChildren(int count, double value)
+{
+    for (int action = 0; action < NumChildren; action++)
+    {
+        SMC_QNODE& qnode = Children[action];
+        qnode.Value.Set(count, value);
+        qnode.AMAF.Set(count, value);
+    }
+}
+
+void SMC_VNODE::DisplayValue(HISTORY& history, int maxDepth, ostream& ostr) const
+{
+    if (history.Size() >= maxDepth)
+        return;
+
+    for (int action = 0; action < NumChildren; action++)
+    {
+        history.Add(action);
+        Children[action].DisplayValue(history, maxDepth, ostr);
+        history.Pop();
+    }
+}
+
+void SMC_VNODE::DisplayPolicy(HISTORY& history, int maxDepth, ostream& ostr) const
+{
+    if (history.Size() >= maxDepth)
+        return;
+
+    double bestq = -Infinity;
+    int besta = -1;
+    for (int action = 0; action < NumChildren; action++)
+    {
+        if (Children[action].Value.GetValue() > bestq)
+        {
+            besta = action;
+            bestq = Children[action].Value.GetValue();
+        }
+    }
+
+    if (besta != -1)
+    {
+        history.Add(besta);
+        Children[besta].DisplayPolicy(history, maxDepth, ostr);
+        history.Pop();
+    }
+}
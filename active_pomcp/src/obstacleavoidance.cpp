@@ -204,47 +204,38 @@ void OBSTACLEAVOIDANCE::FreeState(STATE* state) const
 }
 
 
+// Collision model, by engine power (rows) and segment difficulty (columns)
+double OBSTACLEAVOIDANCE::collision_probability(int action, int difficulty) const
+{
+    static const double prob[3][3] = {
+        { 0.0, 0.0,   0.028 },
+        { 0.0, 0.056, 0.11  },
+        { 0.0, 0.14,  0.25  },
+    };
+    return prob[action][difficulty];
+}
+
+// Observation model, probability of observing an obstacle by segment
+// difficulty
+double OBSTACLEAVOIDANCE::observe_obstacle_probability(int difficulty) const
+{
+    static const double prob[3] = { 0.44, 0.79, 0.86 };
+    return prob[difficulty];
+}
+
 bool OBSTACLEAVOIDANCE::Step(STATE& state, int action,
         observation_t& observation, double& reward) const
 {
     OBSTACLEAVOIDANCE_STATE& s = safe_cast<OBSTACLEAVOIDANCE_STATE&>(state);
+    if (rollout_model)
+        return rollout_step(s, action, observation, reward);
 
     s.acs.push_back(action); // In history
 
     s.v=action;
     s.vs.push_back(action);
-    double prob_collision;
-
-    // Model
-    if((action==0) && (s.segDifficulties[s.curSegI]==0)){ // Low difficulty
-        prob_collision=0.0; // 0.0
-    }
-    if((action==0) && (s.segDifficulties[s.curSegI]==1)){ // Medium difficulty
-        prob_collision=0.0; // 0.0
-    }
-    if((action==0) && (s.segDifficulties[s.curSegI]==2)){ // High difficulty
-        prob_collision=0.028; // 0.028
-    }
-
-    if((action==1) && (s.segDifficulties[s.curSegI]==0)){ // Low difficulty
-        prob_collision=0.0; // 0.0
-    }
-    if((action==1) && (s.segDifficulties[s.curSegI]==1)){ // Medium difficulty
-        prob_collision=0.056; // 0.056
-    }
-    if((action==1) && (s.segDifficulties[s.curSegI]==2)){ // High difficulty
-        prob_collision=0.11; // 0.11
-    }
-
-    if((action==2) && (s.segDifficulties[s.curSegI]==0)){ // Low difficulty
-        prob_collision=0.0; // 0.0
-    }
-    if((action==2) && (s.segDifficulties[s.curSegI]==1)){ // Medium difficulty
-        prob_collision=0.14; // 0.14
-    }
-    if((action==2) && (s.segDifficulties[s.curSegI]==2)){ // High difficulty
-        prob_collision=0.25; // 0.25
-    }
+    double prob_collision =
+        collision_probability(action, s.segDifficulties[s.curSegI]);
 
     // 1  collision, 0 = no collision
     int dp= unif_dist(random_state) < prob_collision ? 1 : 0;
@@ -303,19 +294,39 @@ bool OBSTACLEAVOIDANCE::Step(STATE& state, int action,
         return false;
 }
 
-void OBSTACLEAVOIDANCE::set_observation(SIMULATOR::observation_t &obs,
-                                        OBSTACLEAVOIDANCE_STATE &s) const {
-    double prob_observe_obstacle;
+bool OBSTACLEAVOIDANCE::rollout_step(OBSTACLEAVOIDANCE_STATE &s, int action,
+                                     observation_t &observation,
+                                     double &reward) const {
+    reward = ExpectedReward(s, action);
+    observation = 0;
 
-    if (s.segDifficulties[s.curSegI] == 0) { // Low difficulty
-        prob_observe_obstacle = 0.44;        // 0.44
-    }
-    if (s.segDifficulties[s.curSegI] == 1) { // Medium difficulty
-        prob_observe_obstacle = 0.79;        // 0.79
+    bool is_last = s.curSegI == (nSeg-1) && s.curSubsegJ==(nSubSegs[s.curSegI]-1);
+    if (s.curSubsegJ==(nSubSegs[s.curSegI]-1)) {
+        s.curSegI += 1;
+        s.curSubsegJ = 0;
     }
-    if (s.segDifficulties[s.curSegI] == 2) { // High difficulty
-        prob_observe_obstacle = 0.86;        // 0.86
+    else {
+        s.curSubsegJ += 1;
     }
+    return is_last;
+}
+
+STATE* OBSTACLEAVOIDANCE::ConvertState(const STATE& state) const
+{
+    // Only what rollout_step reads, the history vectors stay empty
+    const OBSTACLEAVOIDANCE_STATE& s =
+        safe_cast<const OBSTACLEAVOIDANCE_STATE&>(state);
+    OBSTACLEAVOIDANCE_STATE* newstate = MemoryPool.Allocate();
+    newstate->segDifficulties = s.segDifficulties;
+    newstate->curSegI = s.curSegI;
+    newstate->curSubsegJ = s.curSubsegJ;
+    return newstate;
+}
+
+void OBSTACLEAVOIDANCE::set_observation(SIMULATOR::observation_t &obs,
+                                        OBSTACLEAVOIDANCE_STATE &s) const {
+    double prob_observe_obstacle =
+        observe_obstacle_probability(s.segDifficulties[s.curSegI]);
     int o = unif_dist(random_state) < prob_observe_obstacle ? 1 : 0;
 
     s.o = o;           // In state <-------------------------
@@ -332,29 +343,197 @@ void OBSTACLEAVOIDANCE::reset_observation(SIMULATOR::observation_t &obs,
     obs = value;
 }
 
+double OBSTACLEAVOIDANCE::EvaluateLeaf(const STATE& state,
+        const HISTORY& history, int depth) const
+{
+    const OBSTACLEAVOIDANCE_STATE& s =
+        safe_cast<const OBSTACLEAVOIDANCE_STATE&>(state);
+
+    // The lowest engine power earns the most time reward and has the lowest
+    // collision probability in every difficulty, so it is optimal whatever
+    // the difficulties are: the rest of the route has a closed form value
+    double value = 0.0, discount = 1.0;
+    int j = s.curSubsegJ;
+    for (int i = s.curSegI; i < nSeg; ++i, j = 0) {
+        for (; j < nSubSegs[i]; ++j) {
+            value += discount * (nVelocityValues * subSegLengths[i][j]
+                - collision_probability(0, s.segDifficulties[i])
+                * collisionPenaltyTime);
+            discount *= Discount;
+        }
+    }
+    return value;
+}
+
+double OBSTACLEAVOIDANCE::ExpectedReward(const STATE& state, int action) const
+{
+    const OBSTACLEAVOIDANCE_STATE& s =
+        safe_cast<const OBSTACLEAVOIDANCE_STATE&>(state);
+
+    // Step reward is the travel time less the collision penalty
+    return (nVelocityValues - action) * subSegLengths[s.curSegI][s.curSubsegJ]
+        - collision_probability(action, s.segDifficulties[s.curSegI])
+        * collisionPenaltyTime;
+}
+
 bool OBSTACLEAVOIDANCE::LocalMove(STATE& state, const HISTORY& history,
         int stepObs, const STATUS& status) const
 {
     return true;
 }
 
+BELIEF_META_INFO* OBSTACLEAVOIDANCE::CreateExactBelief() const
+{
+    // Uniform and independent, as in CreateStartState
+    OBSTACLEAVOIDANCE_METAINFO* belief = new OBSTACLEAVOIDANCE_METAINFO();
+    for (int seg = 0; seg < nSeg; ++seg)
+        for (int diff = 0; diff < nDifficultyValues; ++diff)
+            belief->set_prob_diff(seg, diff, 1.0 / nDifficultyValues);
+    belief->set_position(0, 0);
+    return belief;
+}
+
+bool OBSTACLEAVOIDANCE::UpdateExactBelief(BELIEF_META_INFO& belief, int action,
+        observation_t observation) const
+{
+    OBSTACLEAVOIDANCE_METAINFO& meta = safe_cast<OBSTACLEAVOIDANCE_METAINFO&>(belief);
+    int seg = meta.seg(), subseg = meta.subseg();
+    if (seg >= nSeg)
+        return false;
+
+    // The observation only depends on the difficulty of the current segment
+    double likelihood[3], total = 0.0;
+    for (int diff = 0; diff < nDifficultyValues; ++diff)
+    {
+        double p = observation == 1 ? observe_obstacle_probability(diff)
+            : 1.0 - observe_obstacle_probability(diff);
+        likelihood[diff] = meta.get_prob_diff(seg, diff) * p;
+        total += likelihood[diff];
+    }
+    if (total <= 0)
+        return false;
+    for (int diff = 0; diff < nDifficultyValues; ++diff)
+        meta.set_prob_diff(seg, diff, likelihood[diff] / total);
+
+    // Move on as in Step
+    if (subseg == nSubSegs[seg] - 1)
+        meta.set_position(seg + 1, 0);
+    else
+        meta.set_position(seg, subseg + 1);
+    return true;
+}
+
+STATE* OBSTACLEAVOIDANCE::CreateSample(const BELIEF_META_INFO& belief) const
+{
+    const OBSTACLEAVOIDANCE_METAINFO& meta =
+        safe_cast<const OBSTACLEAVOIDANCE_METAINFO&>(belief);
+
+    // Collisions so far are not part of the belief, they do not affect the
+    // future dynamics
+    OBSTACLEAVOIDANCE_STATE* bmState =
+        safe_cast<OBSTACLEAVOIDANCE_STATE*>(CreateStartStateFixedValues(
+            std::vector<int>(nSeg, 0)));
+    bmState->curSegI = meta.seg();
+    bmState->curSubsegJ = meta.subseg();
+    for (int seg = 0; seg < nSeg; ++seg)
+    {
+        double u = unif_dist(random_state);
+        int diff = 0;
+        while (diff + 1 < nDifficultyValues && u >= meta.get_prob_diff(seg, diff))
+        {
+            u -= meta.get_prob_diff(seg, diff);
+            diff++;
+        }
+        bmState->segDifficulties[seg] = diff;
+    }
+    return bmState;
+}
+
+uint64_t OBSTACLEAVOIDANCE::HistoryKey(const STATE& state, int action,
+        observation_t observation) const
+{
+    // The belief only depends on how many obstacles were sensed in each
+    // segment; the state has already moved past the observed subsegment
+    const OBSTACLEAVOIDANCE_STATE& s = safe_cast<const OBSTACLEAVOIDANCE_STATE&>(state);
+    int seg = s.curSubsegJ == 0 ? s.curSegI - 1 : s.curSegI;
+    return Mix64((uint64_t(seg) << 8) | observation);
+}
+
+uint64_t OBSTACLEAVOIDANCE::ObservedHash(const STATE& state) const
+{
+    const OBSTACLEAVOIDANCE_STATE& s = safe_cast<const OBSTACLEAVOIDANCE_STATE&>(state);
+    return Mix64((uint64_t(s.curSegI) << 16) | s.curSubsegJ);
+}
+
+size_t OBSTACLEAVOIDANCE::StateHash(const STATE& state) const
+{
+    const OBSTACLEAVOIDANCE_STATE& s = safe_cast<const OBSTACLEAVOIDANCE_STATE&>(state);
+    size_t hash = s.curSegI * 16 + s.curSubsegJ;
+    for (int d : s.segDifficulties)
+        hash = hash * 3 + d;
+    return hash * 31 + s.p;
+}
+
+bool OBSTACLEAVOIDANCE::StateEquals(const STATE& state1, const STATE& state2) const
+{
+    // Everything Step reads or accumulates; the per-step histories are only
+    // kept for data analysis and are not compared
+    const OBSTACLEAVOIDANCE_STATE& s1 = safe_cast<const OBSTACLEAVOIDANCE_STATE&>(state1);
+    const OBSTACLEAVOIDANCE_STATE& s2 = safe_cast<const OBSTACLEAVOIDANCE_STATE&>(state2);
+    return s1.segDifficulties == s2.segDifficulties &&
+        s1.curSegI == s2.curSegI && s1.curSubsegJ == s2.curSubsegJ &&
+        s1.p == s2.p && s1.v == s2.v && s1.o == s2.o && s1.dp == s2.dp &&
+        s1.t == s2.t && s1.r_total == s2.r_total;
+}
+
+double OBSTACLEAVOIDANCE::ObservationProbability(const STATE& state, int action,
+        observation_t observation) const
+{
+    const OBSTACLEAVOIDANCE_STATE& s = safe_cast<const OBSTACLEAVOIDANCE_STATE&>(state);
+
+    // Step has already moved on, the observation refers to the previous
+    // subsegment (a new segment starts from subsegment 0)
+    int seg = s.curSubsegJ == 0 ? s.curSegI - 1 : s.curSegI;
+    assert(seg >= 0 && seg < nSeg);
+
+    double prob_observe_obstacle =
+        observe_obstacle_probability(s.segDifficulties[seg]);
+    return observation == 1 ? prob_observe_obstacle : 1.0 - prob_observe_obstacle;
+}
+
+void OBSTACLEAVOIDANCE::SetObservation(STATE& state, int action,
+        observation_t stepObs, observation_t realObs) const
+{
+    OBSTACLEAVOIDANCE_STATE& s = safe_cast<OBSTACLEAVOIDANCE_STATE&>(state);
+    reset_observation(stepObs, realObs, s);
+}
+
 
 
 // Puts in legal a set of legal actions that can be taken from state
 void OBSTACLEAVOIDANCE::GenerateLegal(const STATE& state, const HISTORY& history,
         vector<int>& legal, const STATUS& status) const
 {
-    legal.push_back(0);
-    legal.push_back(1);
-    legal.push_back(2);
+    MaskToActions(LegalMask(state, history, status), legal);
 }
 
 void OBSTACLEAVOIDANCE::GeneratePreferred(const STATE& state, const HISTORY& history,
         vector<int>& actions, const STATUS& status) const
 {
-    actions.push_back(0);
-    actions.push_back(1);
-    actions.push_back(2);
+    MaskToActions(PreferredMask(state, history, status), actions);
+}
+
+uint64_t OBSTACLEAVOIDANCE::LegalMask(const STATE& state,
+        const HISTORY& history, const STATUS& status) const
+{
+    // engine powers 0, 1 and 2
+    return 0x7;
+}
+
+uint64_t OBSTACLEAVOIDANCE::PreferredMask(const STATE& state,
+        const HISTORY& history, const STATUS& status) const
+{
+    return 0x7;
 }
 
 // Display methods -------------------------
@@ -394,11 +573,7 @@ void OBSTACLEAVOIDANCE::DisplayBeliefDistribution(const BELIEF_STATE& beliefStat
         {
             id+=bmState.segDifficulties[j]*(pow(3,nSeg-j-1));
         }
-        // If it is not in dist then add it and initialize to 1
-        if (dist.find(id) == dist.end())
-            dist[id]= 1;
-        else
-            dist[id]++;
+        dist[id] += beliefState.GetCount(i);
     }
     for (auto it = dist.begin(); it != dist.end(); ++it ){  // For each state in the belief
         ostr << it->first << ":" << it->second << ", ";
@@ -800,11 +975,7 @@ void OBSTACLEAVOIDANCE::log_beliefs(const BELIEF_STATE& beliefState) const {
         {
             id+=bmState.segDifficulties[j]*(pow(3,nSeg-j-1));
         }
-        // If it is not in dist then add it and initialize to 1
-        if (dist.find(id) == dist.end())
-            dist[id]= 1;
-        else
-            dist[id]++;
+        dist[id] += beliefState.GetCount(i);
     }
 
     const OBSTACLEAVOIDANCE_STATE& bmState =
@@ -850,25 +1021,33 @@ void OBSTACLEAVOIDANCE::set_belief_metainfo(VNODE *v, const SIMULATOR &) const {
 }
 
 void OBSTACLEAVOIDANCE::pre_shield(const BELIEF_STATE &belief, std::vector<int> &legal_actions) const {
-    const STATE* state = belief.GetSample(0);
-    const OBSTACLEAVOIDANCE_STATE& vrstate =
-        safe_cast<const OBSTACLEAVOIDANCE_STATE&>(*state);
     const auto& meta =
         dynamic_cast<const OBSTACLEAVOIDANCE_METAINFO&>(belief.get_metainfo());
-    double p0 = meta.get_prob_diff(vrstate.curSegI, 0);
-    double p1 = meta.get_prob_diff(vrstate.curSegI, 1);
-    double p2 = meta.get_prob_diff(vrstate.curSegI, 2);
+    double p0 = meta.get_prob_diff(meta.seg(), 0);
+    double p1 = meta.get_prob_diff(meta.seg(), 1);
+    double p2 = meta.get_prob_diff(meta.seg(), 2);
 
     // speed 0 and 1 are always legal
     legal_actions = {0, 1};
 
-    if (p0 >= shield_x1 || p2 <= shield_x2 ||
-            (p0 >= shield_x3 && p1 >= shield_x4)) {
+    if (speed_2_rule(p0, p1, p2))
         legal_actions.push_back(2);
-    }
-    else if (complex_shield && speed_2_points.is_in_threshold({p0, p1, p2})) {
-        legal_actions.push_back(2);
-    }
+}
+
+bool OBSTACLEAVOIDANCE::speed_2_rule(double p0, double p1, double p2) const {
+    if (p0 >= shield_x1 || p2 <= shield_x2 ||
+            (p0 >= shield_x3 && p1 >= shield_x4))
+        return true;
+    return complex_shield && speed_2_points.is_in_threshold({p0, p1, p2});
+}
+
+void OBSTACLEAVOIDANCE::RuleActions(const BELIEF_STATE &belief, std::vector<int> &actions) const {
+    const auto& meta =
+        dynamic_cast<const OBSTACLEAVOIDANCE_METAINFO&>(belief.get_metainfo());
+    int seg = meta.seg();
+    if (speed_2_rule(meta.get_prob_diff(seg, 0), meta.get_prob_diff(seg, 1),
+                     meta.get_prob_diff(seg, 2)))
+        actions.push_back(2);
 }
 
 bool OBSTACLEAVOIDANCE::Step(const VNODE *const mcts_root, STATE &state, int action, 
@@ -51,12 +51,31 @@ public:
                 j = 0;
     }
 
-    virtual void update(STATE *s) {
+    virtual void update(STATE *s, int count) {
         const OBSTACLEAVOIDANCE_STATE& state = safe_cast<const OBSTACLEAVOIDANCE_STATE&>(*s);
-        total++;
+        total += count;
         for (int i = 0; i < 8; i++) {  // For each segment difficulty
-            distr[i][state.segDifficulties[i]] += 1;
+            distr[i][state.segDifficulties[i]] += count;
         }
+        seg_ = state.curSegI;
+        subseg_ = state.curSubsegJ;
+    }
+
+    virtual void update_all(const std::vector<STATE *> &states,
+                            const std::vector<int> &counts) {
+        if (states.empty())
+            return;
+        for (size_t p = 0; p < states.size(); p++) {
+            const auto &diffs =
+                safe_cast<const OBSTACLEAVOIDANCE_STATE *>(states[p])->segDifficulties;
+            const double c = counts[p];
+            total += c;
+            for (int i = 0; i < 8; i++)
+                distr[i][diffs[i]] += c;
+        }
+        const auto &last = safe_cast<const OBSTACLEAVOIDANCE_STATE &>(*states.back());
+        seg_ = last.curSegI;
+        subseg_ = last.curSubsegJ;
     }
 
     virtual void clear() {
@@ -66,9 +85,38 @@ public:
                 j = 0;
     }
 
-    int get_total() const { return total; }
+    double get_total() const { return total; }
     double get_prob_diff(int segment, int diff) const { 
-        return static_cast<double>(distr[segment][diff]) / total;
+        return distr[segment][diff] / total;
+    }
+
+    // Exact belief: difficulties are independent a priori and each
+    // observation depends on a single segment, so marginals are exact
+    void set_prob_diff(int segment, int diff, double p) {
+        distr[segment][diff] = p;
+        total = 1.0;
+    }
+    void set_position(int seg, int subseg) {
+        seg_ = seg;
+        subseg_ = subseg;
+    }
+
+    int seg() const { return seg_; }
+    int subseg() const { return subseg_; }
+
+    // Mean entropy of the difficulties of the segments still ahead
+    virtual double entropy() const {
+        if (total <= 0)
+            return -1;
+        double sum = 0;
+        for (size_t i = seg_; i < distr.size(); i++) {
+            for (double c : distr[i]) {
+                double p = c / total;
+                if (p > 0)
+                    sum -= p * std::log(p) / std::log(3.0);
+            }
+        }
+        return seg_ < (int) distr.size() ? sum / (distr.size() - seg_) : 0;
     }
 
     virtual BELIEF_META_INFO *clone() const {
@@ -78,8 +126,10 @@ public:
 
 private:
 
-    std::array<std::array<int, 3>, 8> distr;
-    int total = 0;
+    // difficulty counts, or marginal probabilities with total = 1
+    std::array<std::array<double, 3>, 8> distr;
+    double total = 0;
+    int seg_ = 0, subseg_ = 0;
 };
 
 class OBSTACLEAVOIDANCE : public SIMULATOR
@@ -103,8 +153,34 @@ class OBSTACLEAVOIDANCE : public SIMULATOR
                 std::vector<int>& legal, const STATUS& status) const;
         void GeneratePreferred(const STATE& state, const HISTORY& history,
                 std::vector<int>& legal, const STATUS& status) const;
+        virtual bool HasActionMask() const { return true; }
+        virtual uint64_t LegalMask(const STATE& state, const HISTORY& history,
+                const STATUS& status) const;
+        virtual uint64_t PreferredMask(const STATE& state,
+                const HISTORY& history, const STATUS& status) const;
         virtual bool LocalMove(STATE& state, const HISTORY& history,
                 int stepObservation, const STATUS& status) const;
+        virtual double EvaluateLeaf(const STATE& state,
+                const HISTORY& history, int depth) const;
+        virtual bool HasExpectedReward() const { return true; }
+        virtual double ExpectedReward(const STATE& state, int action) const;
+        virtual bool HasHistorySignature() const { return true; }
+        virtual uint64_t HistoryKey(const STATE& state, int action,
+                observation_t observation) const;
+        virtual uint64_t ObservedHash(const STATE& state) const;
+        virtual bool HasStateHash() const { return true; }
+        virtual std::size_t StateHash(const STATE& state) const;
+        virtual bool StateEquals(const STATE& state1, const STATE& state2) const;
+        virtual bool HasExactBelief() const { return true; }
+        virtual BELIEF_META_INFO* CreateExactBelief() const;
+        virtual bool UpdateExactBelief(BELIEF_META_INFO& belief, int action,
+                observation_t observation) const;
+        virtual STATE* CreateSample(const BELIEF_META_INFO& belief) const;
+        virtual bool HasObservationProbability() const { return true; }
+        virtual double ObservationProbability(const STATE& state, int action,
+                observation_t observation) const;
+        virtual void SetObservation(STATE& state, int action,
+                observation_t stepObservation, observation_t observation) const;
 
         virtual void DisplayBeliefs(const BELIEF_STATE& beliefState,
                 std::ostream& ostr) const;
@@ -140,11 +216,19 @@ class OBSTACLEAVOIDANCE : public SIMULATOR
     }
 
     virtual void pre_shield(const BELIEF_STATE &belief, std::vector<int> &legal_actions) const;
+    virtual void RuleActions(const BELIEF_STATE &belief, std::vector<int> &actions) const;
 
     void set_visual(std::vector<std::vector<std::pair<double,double>>> v) {
         visual = v;
     }
 
+    // As a rollout model Step keeps no history and no observation, and the
+    // reward is the expected one
+    void set_rollout_model(bool r) {
+        rollout_model = r;
+    }
+    virtual STATE* ConvertState(const STATE& state) const;
+
     protected:
         int nSeg;
         std::vector<int> nSubSegs;
@@ -157,13 +241,20 @@ class OBSTACLEAVOIDANCE : public SIMULATOR
         mutable MEMORY_POOL<OBSTACLEAVOIDANCE_STATE> MemoryPool;
 
         void set_observation(SIMULATOR::observation_t &obs, OBSTACLEAVOIDANCE_STATE &s) const;
+        double collision_probability(int action, int difficulty) const;
+        double observe_obstacle_probability(int difficulty) const;
         void reset_observation(SIMULATOR::observation_t &obs,
                                SIMULATOR::observation_t value,
                                OBSTACLEAVOIDANCE_STATE &s) const;
-        hellinger_shield<3> speed_2_points;
+        hellinger_tree<3> speed_2_points;
+        bool speed_2_rule(double p0, double p1, double p2) const;
         double shield_x1, shield_x2, shield_x3, shield_x4;
         mutable std::uniform_real_distribution<> unif_dist;
         std::vector<std::vector<std::pair<double,double>>> visual;
+        bool rollout_model = false;
+
+        bool rollout_step(OBSTACLEAVOIDANCE_STATE &s, int action,
+                          observation_t &observation, double &reward) const;
 };
 
 #endif
@@ -15,15 +15,12 @@ public:
         const auto &info =
             safe_cast<const OBSTACLEAVOIDANCE_METAINFO &>(b.get_metainfo());
 
-        const auto *state =
-            safe_cast<const OBSTACLEAVOIDANCE_STATE *>(b.GetSample(0));
-
         for (int seg = 0; seg < 8; seg++)
             for (int diff = 0; diff < 3; diff++)
                 distr_[seg][diff] = info.get_prob_diff(seg, diff);
 
-        seg_ = state->curSegI;
-        subseg_ = state->curSubsegJ;
+        seg_ = info.seg();
+        subseg_ = info.subseg();
     }
 
     void build_from_json(std::vector<double> r, int x, int y) {
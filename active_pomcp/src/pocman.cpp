@@ -18,7 +18,8 @@ POCMAN::POCMAN(int xsize, int ysize)
     RewardDie(-100),
     RewardEatFood(+10),
     RewardEatGhost(+25),
-    RewardHitWall(-25)
+    RewardHitWall(-25),
+    RolloutModel(false)
 {
     NumActions = 4;
     NumObservations = 1 << 10;
@@ -216,7 +217,10 @@ bool POCMAN::Step(STATE& state, int action,
         }
     }
 
-    observation = MakeObservations(pocstate);
+    if (RolloutModel)
+        observation = SeeGhosts(pocstate);
+    else
+        observation = MakeObservations(pocstate);
 
     int pocIndex = Maze.Index(pocstate.PocmanPos);
     if (pocstate.Food[pocIndex])
@@ -236,13 +240,20 @@ bool POCMAN::Step(STATE& state, int action,
     return false;
 }
 
-int POCMAN::MakeObservations(const POCMAN_STATE& pocstate) const
+int POCMAN::SeeGhosts(const POCMAN_STATE& pocstate) const
 {
     int observation = 0;
     for (int d = 0; d < 4; d++)
-    {
         if (SeeGhost(pocstate, d) >= 0)
             SetFlag(observation, d);
+    return observation;
+}
+
+int POCMAN::MakeObservations(const POCMAN_STATE& pocstate) const
+{
+    int observation = SeeGhosts(pocstate);
+    for (int d = 0; d < 4; d++)
+    {
         COORD wpos = NextPos(pocstate.PocmanPos, d);
         if (wpos.Valid() && Passable(wpos))
             SetFlag(observation, d + 4);
@@ -254,6 +265,18 @@ int POCMAN::MakeObservations(const POCMAN_STATE& pocstate) const
     return observation;
 }
 
+SIMULATOR::observation_t POCMAN::AbstractObservation(
+    observation_t observation, const HISTORY& history) const
+{
+    // The wall bits follow from pocman's position, which the actions
+    // determine, so they never separate two beliefs. Ghost sightings are
+    // collapsed to whether any ghost is in sight.
+    int abstract = observation & 0x300; // smell and hearing
+    if (observation & 0xf)
+        SetFlag(abstract, 0);
+    return abstract;
+}
+
 bool POCMAN::LocalMove(STATE& state, const HISTORY& history,
     observation_t stepObs, const STATUS& status) const
 {
@@ -449,22 +472,37 @@ bool POCMAN::SmellFood(const POCMAN_STATE& pocstate) const
 
 void POCMAN::GenerateLegal(const STATE& state, const HISTORY& history, 
     vector<int>& legal, const STATUS& status) const
+{
+    MaskToActions(LegalMask(state, history, status), legal);
+}
+
+void POCMAN::GeneratePreferred(const STATE& state, const HISTORY& history, 
+    vector<int>& actions, const STATUS& status) const
+{
+    MaskToActions(PreferredMask(state, history, status), actions);
+}
+
+uint64_t POCMAN::LegalMask(const STATE& state, const HISTORY& history,
+    const STATUS& status) const
 {
     const POCMAN_STATE& pocstate = safe_cast<const POCMAN_STATE&>(state);
+    uint64_t legal = 0;
 
     // Don't move into walls 
     for (int a = 0; a < 4; ++a)
     {
         COORD newpos = NextPos(pocstate.PocmanPos, a);
         if (newpos.Valid())
-            legal.push_back(a);
+            legal |= 1ULL << a;
     }
+    return legal;
 }
 
-void POCMAN::GeneratePreferred(const STATE& state, const HISTORY& history, 
-    vector<int>& actions, const STATUS& status) const
+uint64_t POCMAN::PreferredMask(const STATE& state, const HISTORY& history,
+    const STATUS& status) const
 {
     const POCMAN_STATE& pocstate = safe_cast<const POCMAN_STATE&>(state);
+    uint64_t actions = 0;
     if (history.Size())
     {
         int action = history.Back().Action;
@@ -475,7 +513,7 @@ void POCMAN::GeneratePreferred(const STATE& state, const HISTORY& history,
         {
             for (int a = 0; a < 4; ++a)
                 if (CheckFlag(observation, a))
-                    actions.push_back(a);
+                    actions |= 1ULL << a;
         }
         
         // Otherwise avoid observed ghosts and avoid changing directions
@@ -486,10 +524,11 @@ void POCMAN::GeneratePreferred(const STATE& state, const HISTORY& history,
                 COORD newpos = NextPos(pocstate.PocmanPos, a);        
                 if (newpos.Valid() && !CheckFlag(observation, a)
                     && COORD::Opposite(a) != action)
-                    actions.push_back(a);
+                    actions |= 1ULL << a;
             }
         }
     }
+    return actions;
 }
 
 void POCMAN::DisplayBeliefs(const BELIEF_STATE& beliefState,
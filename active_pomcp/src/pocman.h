@@ -31,10 +31,17 @@ public:
 
     virtual bool LocalMove(STATE& state, const HISTORY& history,
         observation_t stepObs, const STATUS& status) const;
+    virtual observation_t AbstractObservation(observation_t observation,
+        const HISTORY& history) const;
     void GenerateLegal(const STATE& state, const HISTORY& history,
         std::vector<int>& legal, const STATUS& status) const;
     void GeneratePreferred(const STATE& state, const HISTORY& history,
         std::vector<int>& legal, const STATUS& status) const;
+    virtual bool HasActionMask() const { return true; }
+    virtual uint64_t LegalMask(const STATE& state, const HISTORY& history,
+        const STATUS& status) const;
+    virtual uint64_t PreferredMask(const STATE& state, const HISTORY& history,
+        const STATUS& status) const;
 
     virtual void DisplayBeliefs(const BELIEF_STATE& beliefState, 
         std::ostream& ostr) const;
@@ -42,6 +49,10 @@ public:
     virtual void DisplayObservation(const STATE& state, observation_t observation, std::ostream& ostr) const;
     virtual void DisplayAction(int action, std::ostream& ostr) const;
 
+    // As a rollout model Step observes only the ghost sightings, the bits
+    // the preferred actions read, and skips the walls, smell and hearing
+    void SetRolloutModel(bool rolloutModel) { RolloutModel = rolloutModel; }
+
 protected:
 
     POCMAN(int xsize, int ysize);
@@ -73,6 +84,9 @@ private:
     COORD NextPos(const COORD& from, int dir) const;
     bool Passable(const COORD& pos) const { return UTILS::CheckFlag(Maze(pos), E_PASSABLE); }
     int MakeObservations(const POCMAN_STATE& pocstate) const;
+    int SeeGhosts(const POCMAN_STATE& pocstate) const;
+
+    bool RolloutModel;
 
     mutable MEMORY_POOL<POCMAN_STATE> MemoryPool;
 };
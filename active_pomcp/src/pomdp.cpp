@@ -0,0 +1,919 @@
+#include "pomdp.h"
+#include "utils.h"
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+using namespace UTILS;
+
+//-----------------------------------------------------------------------------
+// Token stream for the .pomdp and .alpha formats: '#' starts a comment,
+// ':' is a token on its own, everything else is whitespace separated.
+
+class POMDP_TOKENS
+{
+public:
+    POMDP_TOKENS(istream& is, bool colons)
+    :   Pos(0)
+    {
+        string line;
+        while (getline(is, line))
+        {
+            size_t comment = line.find('#');
+            if (comment != string::npos)
+                line.erase(comment);
+            string token;
+            for (char c : line)
+            {
+                if (isspace(static_cast<unsigned char>(c)) || (colons && c == ':'))
+                {
+                    if (!token.empty())
+                        Tokens.push_back(token);
+                    token.clear();
+                    if (c == ':')
+                        Tokens.push_back(":");
+                }
+                else
+                    token += c;
+            }
+            if (!token.empty())
+                Tokens.push_back(token);
+        }
+    }
+
+    bool End() const { return Pos >= (int) Tokens.size(); }
+    const string& Peek(int offset = 0) const
+    {
+        static const string empty;
+        if (Pos + offset >= (int) Tokens.size())
+            return empty;
+        return Tokens[Pos + offset];
+    }
+    string Next()
+    {
+        if (End())
+            throw runtime_error("POMDP: unexpected end of file");
+        return Tokens[Pos++];
+    }
+    void Expect(const string& token)
+    {
+        string t = Next();
+        if (t != token)
+            throw runtime_error("POMDP: expected '" + token + "', found '" + t + "'");
+    }
+
+    // Start of a new section ("keyword :" or "start include/exclude :")
+    bool AtKeyword() const
+    {
+        const string& t = Peek();
+        if (t == "start" && (Peek(1) == "include" || Peek(1) == "exclude"))
+            return true;
+        return Peek(1) == ":" && (t == "discount" || t == "values"
+            || t == "states" || t == "actions" || t == "observations"
+            || t == "start" || t == "T" || t == "O" || t == "R");
+    }
+
+    static bool IsNumber(const string& t)
+    {
+        if (t.empty())
+            return false;
+        char* end;
+        strtod(t.c_str(), &end);
+        return *end == '\0';
+    }
+
+    static bool IsInteger(const string& t)
+    {
+        if (t.empty())
+            return false;
+        for (char c : t)
+            if (!isdigit(static_cast<unsigned char>(c)))
+                return false;
+        return true;
+    }
+
+    double NextNumber()
+    {
+        string t = Next();
+        if (!IsNumber(t))
+            throw runtime_error("POMDP: expected a number, found '" + t + "'");
+        return strtod(t.c_str(), 0);
+    }
+
+private:
+    vector<string> Tokens;
+    int Pos;
+};
+
+// Index of a state/action/observation, or -1 for the '*' wildcard
+static int ParseIndex(const string& token, const vector<string>& names,
+    int count, const char* what)
+{
+    if (token == "*")
+        return -1;
+    if (POMDP_TOKENS::IsInteger(token))
+    {
+        int i = atoi(token.c_str());
+        if (i >= count)
+            throw runtime_error(string("POMDP: ") + what + " " + token + " out of range");
+        return i;
+    }
+    for (int i = 0; i < (int) names.size(); ++i)
+        if (names[i] == token)
+            return i;
+    throw runtime_error(string("POMDP: unknown ") + what + " '" + token + "'");
+}
+
+// Either a count or a list of names
+static int ParseNames(POMDP_TOKENS& tokens, vector<string>& names)
+{
+    names.clear();
+    while (!tokens.End() && !tokens.AtKeyword())
+        names.push_back(tokens.Next());
+    if (names.size() == 1 && POMDP_TOKENS::IsInteger(names[0]))
+    {
+        int count = atoi(names[0].c_str());
+        names.clear();
+        return count;
+    }
+    return names.size();
+}
+
+// Indices matched by a (possibly wildcard) index
+static void Expand(int index, int count, int& begin, int& end)
+{
+    begin = index < 0 ? 0 : index;
+    end = index < 0 ? count : index + 1;
+}
+
+//-----------------------------------------------------------------------------
+
+POMDP::POMDP(const string& modelFile)
+{
+    ifstream iff(modelFile);
+    if (!iff)
+        throw runtime_error("POMDP: cannot open model file " + modelFile);
+    Load(iff);
+}
+
+POMDP::POMDP(istream& model)
+{
+    Load(model);
+}
+
+void POMDP::Load(istream& model)
+{
+    POMDP_TOKENS tokens(model, true);
+    NumStates = 0;
+    NumActions = 0;
+    NumObservations = 0;
+    Discount = 1.0;
+    Cost = false;
+
+    // Preamble
+    vector<string> startTokens;
+    string startMode;
+    while (!tokens.End() && tokens.Peek() != "T" && tokens.Peek() != "O"
+        && tokens.Peek() != "R")
+    {
+        string key = tokens.Next();
+        if (key == "start" && (tokens.Peek() == "include" || tokens.Peek() == "exclude"))
+            startMode = tokens.Next();
+        tokens.Expect(":");
+
+        if (key == "discount")
+            Discount = tokens.NextNumber();
+        else if (key == "values")
+        {
+            string v = tokens.Next();
+            if (v != "reward" && v != "cost")
+                throw runtime_error("POMDP: unknown values '" + v + "'");
+            Cost = v == "cost";
+        }
+        else if (key == "states")
+            NumStates = ParseNames(tokens, StateNames);
+        else if (key == "actions")
+            NumActions = ParseNames(tokens, ActionNames);
+        else if (key == "observations")
+            NumObservations = ParseNames(tokens, ObservationNames);
+        else if (key == "start")
+        {
+            startTokens.clear();
+            while (!tokens.End() && !tokens.AtKeyword())
+                startTokens.push_back(tokens.Next());
+        }
+        else
+            throw runtime_error("POMDP: unknown keyword '" + key + "'");
+    }
+
+    if (NumStates <= 0 || NumActions <= 0 || NumObservations <= 0)
+        throw runtime_error("POMDP: states, actions and observations must be declared");
+    if (Discount <= 0 || Discount > 1)
+        throw runtime_error("POMDP: discount must be in (0, 1]");
+
+    const int S = NumStates, A = NumActions, O = NumObservations;
+
+    // Start distribution, uniform if not given
+    StartBelief.assign(S, 0.0);
+    if (startMode == "include" || startMode == "exclude")
+    {
+        vector<bool> listed(S, false);
+        for (const string& t : startTokens)
+            listed[ParseIndex(t, StateNames, S, "state")] = true;
+        for (int s = 0; s < S; ++s)
+            StartBelief[s] = listed[s] == (startMode == "include") ? 1.0 : 0.0;
+    }
+    else if (startTokens.empty() || (startTokens.size() == 1 && startTokens[0] == "uniform"))
+        StartBelief.assign(S, 1.0);
+    else if (S == 1)
+        StartBelief[0] = 1.0;
+    else if ((int) startTokens.size() == S)
+    {
+        for (int s = 0; s < S; ++s)
+        {
+            if (!POMDP_TOKENS::IsNumber(startTokens[s]))
+                throw runtime_error("POMDP: bad start distribution");
+            StartBelief[s] = strtod(startTokens[s].c_str(), 0);
+        }
+    }
+    else if (startTokens.size() == 1)
+        StartBelief[ParseIndex(startTokens[0], StateNames, S, "state")] = 1.0;
+    else
+        throw runtime_error("POMDP: bad start distribution");
+
+    double startTotal = 0;
+    for (double p : StartBelief)
+        startTotal += p;
+    if (startTotal <= 0)
+        throw runtime_error("POMDP: empty start distribution");
+    for (double& p : StartBelief)
+        p /= startTotal;
+
+    // Specification of T, O and R
+    vector<double> transition((size_t) A * S * S, 0.0);
+    Observation.assign((size_t) A * O * S, 0.0);
+    RewardRules.assign(A * S, vector<REWARD_RULE>());
+
+    while (!tokens.End())
+    {
+        string key = tokens.Next();
+        tokens.Expect(":");
+
+        // Up to four colon separated indices; the third one of O is an
+        // observation
+        int maxSpecs = key == "R" ? 4 : 3;
+        vector<int> spec;
+        const int counts[4] = { A, S, key == "O" ? O : S, O };
+        const vector<string>* names[4] = { &ActionNames, &StateNames,
+            key == "O" ? &ObservationNames : &StateNames, &ObservationNames };
+        const char* what[4] = { "action", "state", key == "O" ? "observation" : "state",
+            "observation" };
+        spec.push_back(ParseIndex(tokens.Next(), *names[0], counts[0], what[0]));
+        while ((int) spec.size() < maxSpecs && tokens.Peek() == ":")
+        {
+            tokens.Next();
+            int i = spec.size();
+            spec.push_back(ParseIndex(tokens.Next(), *names[i], counts[i], what[i]));
+        }
+
+        int a0, a1;
+        Expand(spec[0], A, a0, a1);
+
+        if (key == "T")
+        {
+            // Row (a, s) of the transition matrix
+            auto set = [&](int a, int s, int s2, double p)
+            {
+                transition[((size_t) a * S + s) * S + s2] = p;
+            };
+
+            if (spec.size() == 3)
+            {
+                double p = tokens.NextNumber();
+                int b0, b1, c0, c1;
+                Expand(spec[1], S, b0, b1);
+                Expand(spec[2], S, c0, c1);
+                for (int a = a0; a < a1; ++a)
+                    for (int s = b0; s < b1; ++s)
+                        for (int s2 = c0; s2 < c1; ++s2)
+                            set(a, s, s2, p);
+            }
+            else if (spec.size() == 2)
+            {
+                vector<double> row(S, 1.0 / S);
+                if (tokens.Peek() == "uniform")
+                    tokens.Next();
+                else
+                    for (int s2 = 0; s2 < S; ++s2)
+                        row[s2] = tokens.NextNumber();
+                int b0, b1;
+                Expand(spec[1], S, b0, b1);
+                for (int a = a0; a < a1; ++a)
+                    for (int s = b0; s < b1; ++s)
+                        for (int s2 = 0; s2 < S; ++s2)
+                            set(a, s, s2, row[s2]);
+            }
+            else
+            {
+                vector<double> matrix((size_t) S * S);
+                if (tokens.Peek() == "uniform")
+                {
+                    tokens.Next();
+                    fill(matrix.begin(), matrix.end(), 1.0 / S);
+                }
+                else if (tokens.Peek() == "identity")
+                {
+                    tokens.Next();
+                    fill(matrix.begin(), matrix.end(), 0.0);
+                    for (int s = 0; s < S; ++s)
+                        matrix[(size_t) s * S + s] = 1.0;
+                }
+                else
+                    for (double& p : matrix)
+                        p = tokens.NextNumber();
+                for (int a = a0; a < a1; ++a)
+                    for (int s = 0; s < S; ++s)
+                        for (int s2 = 0; s2 < S; ++s2)
+                            set(a, s, s2, matrix[(size_t) s * S + s2]);
+            }
+        }
+        else if (key == "O")
+        {
+            auto set = [&](int a, int s2, int o, double p)
+            {
+                Observation[((size_t) a * O + o) * S + s2] = p;
+            };
+
+            if (spec.size() == 3)
+            {
+                double p = tokens.NextNumber();
+                int b0, b1, c0, c1;
+                Expand(spec[1], S, b0, b1);
+                Expand(spec[2], O, c0, c1);
+                for (int a = a0; a < a1; ++a)
+                    for (int s2 = b0; s2 < b1; ++s2)
+                        for (int o = c0; o < c1; ++o)
+                            set(a, s2, o, p);
+            }
+            else if (spec.size() == 2)
+            {
+                vector<double> row(O, 1.0 / O);
+                if (tokens.Peek() == "uniform")
+                    tokens.Next();
+                else
+                    for (int o = 0; o < O; ++o)
+                        row[o] = tokens.NextNumber();
+                int b0, b1;
+                Expand(spec[1], S, b0, b1);
+                for (int a = a0; a < a1; ++a)
+                    for (int s2 = b0; s2 < b1; ++s2)
+                        for (int o = 0; o < O; ++o)
+                            set(a, s2, o, row[o]);
+            }
+            else
+            {
+                vector<double> matrix((size_t) S * O, 1.0 / O);
+                if (tokens.Peek() == "uniform")
+                    tokens.Next();
+                else
+                    for (double& p : matrix)
+                        p = tokens.NextNumber();
+                for (int a = a0; a < a1; ++a)
+                    for (int s2 = 0; s2 < S; ++s2)
+                        for (int o = 0; o < O; ++o)
+                            set(a, s2, o, matrix[(size_t) s2 * O + o]);
+            }
+        }
+        else if (key == "R")
+        {
+            if (spec.size() < 2)
+                throw runtime_error("POMDP: reward needs at least action and start state");
+
+            // Expand into single-valued rules, keeping wildcards
+            vector<REWARD_RULE> rules;
+            if (spec.size() == 4)
+                rules.push_back({ spec[2], spec[3], tokens.NextNumber() });
+            else if (spec.size() == 3)
+                for (int o = 0; o < O; ++o)
+                    rules.push_back({ spec[2], o, tokens.NextNumber() });
+            else
+                for (int s2 = 0; s2 < S; ++s2)
+                    for (int o = 0; o < O; ++o)
+                        rules.push_back({ s2, o, tokens.NextNumber() });
+
+            int b0, b1;
+            Expand(spec[1], S, b0, b1);
+            for (int a = a0; a < a1; ++a)
+                for (int s = b0; s < b1; ++s)
+                    for (REWARD_RULE rule : rules)
+                    {
+                        if (Cost)
+                            rule.Value = -rule.Value;
+                        RewardRules[a * S + s].push_back(rule);
+                    }
+        }
+        else
+            throw runtime_error("POMDP: unknown keyword '" + key + "'");
+    }
+
+    Transition.swap(transition);
+    Finalise();
+}
+
+void POMDP::Finalise()
+{
+    const int S = NumStates, A = NumActions, O = NumObservations;
+    const double tolerance = 1e-3;
+
+    // Normalise rows, rejecting anything far from a distribution
+    size_t nonZero = 0;
+    for (int row = 0; row < A * S; ++row)
+    {
+        double* p = &Transition[(size_t) row * S];
+        double total = 0;
+        for (int s2 = 0; s2 < S; ++s2)
+        {
+            total += p[s2];
+            if (p[s2] != 0)
+                nonZero++;
+        }
+        if (fabs(total - 1.0) > tolerance)
+        {
+            ostringstream err;
+            err << "POMDP: transition row of action " << row / S << ", state "
+                << row % S << " sums to " << total;
+            throw runtime_error(err.str());
+        }
+        for (int s2 = 0; s2 < S; ++s2)
+            p[s2] /= total;
+    }
+
+    for (int a = 0; a < A; ++a)
+        for (int s2 = 0; s2 < S; ++s2)
+        {
+            double total = 0;
+            for (int o = 0; o < O; ++o)
+                total += Observation[((size_t) a * O + o) * S + s2];
+            if (fabs(total - 1.0) > tolerance)
+            {
+                ostringstream err;
+                err << "POMDP: observation row of action " << a << ", state "
+                    << s2 << " sums to " << total;
+                throw runtime_error(err.str());
+            }
+            for (int o = 0; o < O; ++o)
+                Observation[((size_t) a * O + o) * S + s2] /= total;
+        }
+
+    // Samplers for the generative model
+    StartSampler.Build(StartBelief);
+
+    TransitionSampler.resize(A * S);
+    for (int row = 0; row < A * S; ++row)
+    {
+        vector<double> p(Transition.begin() + (size_t) row * S,
+            Transition.begin() + (size_t) (row + 1) * S);
+        TransitionSampler[row].Build(p);
+    }
+
+    ObservationSampler.resize(A * S);
+    vector<double> p(O);
+    for (int a = 0; a < A; ++a)
+        for (int s2 = 0; s2 < S; ++s2)
+        {
+            for (int o = 0; o < O; ++o)
+                p[o] = Observation[((size_t) a * O + o) * S + s2];
+            ObservationSampler[a * S + s2].Build(p);
+        }
+
+    // Mostly-zero transition matrices are stored as CSR, so the belief
+    // update only touches the non-zero entries
+    SparseTransitions = nonZero * 10 < (size_t) A * S * S;
+    if (SparseTransitions)
+    {
+        RowStart.assign(A * S + 1, 0);
+        RowIndex.clear();
+        RowValue.clear();
+        RowIndex.reserve(nonZero);
+        RowValue.reserve(nonZero);
+        for (int row = 0; row < A * S; ++row)
+        {
+            const double* t = &Transition[(size_t) row * S];
+            for (int s2 = 0; s2 < S; ++s2)
+                if (t[s2] != 0)
+                {
+                    RowIndex.push_back(s2);
+                    RowValue.push_back(t[s2]);
+                }
+            RowStart[row + 1] = RowIndex.size();
+        }
+        vector<double>().swap(Transition);
+    }
+
+    // Reward range from the spread of the specified values
+    double minReward = 0, maxReward = 0;
+    for (const auto& rules : RewardRules)
+        for (const REWARD_RULE& rule : rules)
+        {
+            minReward = min(minReward, rule.Value);
+            maxReward = max(maxReward, rule.Value);
+        }
+    RewardRange = maxReward > minReward ? maxReward - minReward : 1.0;
+
+    AlphaIndex.assign(A, vector<int>());
+}
+
+void POMDP::LoadPolicy(const string& policyFile)
+{
+    ifstream iff(policyFile);
+    if (!iff)
+        throw runtime_error("POMDP: cannot open policy file " + policyFile);
+    LoadPolicy(iff);
+}
+
+void POMDP::LoadPolicy(istream& policy)
+{
+    // Sequence of "action v(s_0) ... v(s_n-1)"
+    POMDP_TOKENS tokens(policy, false);
+    AlphaVectors.clear();
+    AlphaIndex.assign(NumActions, vector<int>());
+    while (!tokens.End())
+    {
+        string t = tokens.Next();
+        if (!POMDP_TOKENS::IsInteger(t) || atoi(t.c_str()) >= NumActions)
+            throw runtime_error("POMDP: bad action '" + t + "' in policy");
+        AlphaIndex[atoi(t.c_str())].push_back(AlphaVectors.size() / NumStates);
+        for (int s = 0; s < NumStates; ++s)
+        {
+            // Vectors of a cost model are costs too
+            double v = tokens.NextNumber();
+            AlphaVectors.push_back(Cost ? -v : v);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+STATE* POMDP::Copy(const STATE& state) const
+{
+    const POMDP_STATE& pomdpState = safe_cast<const POMDP_STATE&>(state);
+    POMDP_STATE* newstate = MemoryPool.Allocate();
+    *newstate = pomdpState;
+    return newstate;
+}
+
+void POMDP::Validate(const STATE& state) const
+{
+    const POMDP_STATE& pomdpState = safe_cast<const POMDP_STATE&>(state);
+    assert(pomdpState.State >= 0 && pomdpState.State < NumStates);
+    (void) pomdpState;
+}
+
+STATE* POMDP::CreateStartState() const
+{
+    POMDP_STATE* state = MemoryPool.Allocate();
+    state->State = StartSampler.Sample(random_state);
+    return state;
+}
+
+void POMDP::FreeState(STATE* state) const
+{
+    POMDP_STATE* pomdpState = safe_cast<POMDP_STATE*>(state);
+    MemoryPool.Free(pomdpState);
+}
+
+bool POMDP::Step(STATE& state, int action, observation_t& observation,
+    double& reward) const
+{
+    POMDP_STATE& pomdpState = safe_cast<POMDP_STATE&>(state);
+    int s = pomdpState.State;
+    int next = TransitionSampler[action * NumStates + s].Sample(random_state);
+    observation = ObservationSampler[action * NumStates + next].Sample(random_state);
+    reward = Reward(action, s, next, observation);
+    pomdpState.State = next;
+
+    // The format has no terminal states
+    return false;
+}
+
+double POMDP::Reward(int action, int state, int next, int obs) const
+{
+    const vector<REWARD_RULE>& rules = RewardRules[action * NumStates + state];
+    for (auto i_rule = rules.rbegin(); i_rule != rules.rend(); ++i_rule)
+        if ((i_rule->Next < 0 || i_rule->Next == next)
+            && (i_rule->Obs < 0 || i_rule->Obs == obs))
+            return i_rule->Value;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+bool POMDP::HasAlpha() const
+{
+    return !AlphaVectors.empty();
+}
+
+void POMDP::UpdateAlpha(QNODE& qnode, int action, const STATE& state) const
+{
+    const vector<int>& index = AlphaIndex[action];
+    if (index.empty())
+        return;
+
+    const POMDP_STATE& pomdpState = safe_cast<const POMDP_STATE&>(state);
+    ALPHA& alpha = qnode.Alpha();
+    if (alpha.Count == 0)
+        alpha.AlphaSum.assign(index.size(), 0.0);
+    for (int k = 0; k < (int) index.size(); ++k)
+        alpha.AlphaSum[k] += AlphaVectors[(size_t) index[k] * NumStates + pomdpState.State];
+    alpha.Count++;
+}
+
+void POMDP::AlphaValue(const QNODE& qnode, int action, double& q, int& n) const
+{
+    // Best vector for the particles that went through this node
+    const ALPHA& alpha = qnode.Alpha();
+    n = alpha.Count;
+    q = 0;
+    if (n == 0)
+        return;
+
+    double best = -Infinity;
+    for (double sum : alpha.AlphaSum)
+        best = max(best, sum);
+    q = best / n;
+}
+
+//-----------------------------------------------------------------------------
+
+BELIEF_META_INFO* POMDP::CreateExactBelief() const
+{
+    POMDP_METAINFO* belief = new POMDP_METAINFO(NumStates);
+    vector<double> start = StartBelief;
+    belief->set_distribution(std::move(start), 1.0);
+    return belief;
+}
+
+void POMDP::Predict(int action, const vector<double>& prior,
+    vector<double>& next) const
+{
+    // next = T_a^T prior, as a sum of rows so the inner loops run over
+    // contiguous memory and vectorise
+    const int S = NumStates;
+    next.assign(S, 0.0);
+    double* out = next.data();
+
+    if (SparseTransitions)
+    {
+        for (int s = 0; s < S; ++s)
+        {
+            const double w = prior[s];
+            if (w == 0)
+                continue;
+            const int row = action * S + s;
+            const int begin = RowStart[row], end = RowStart[row + 1];
+            const int* index = RowIndex.data();
+            const double* value = RowValue.data();
+            for (int k = begin; k < end; ++k)
+                out[index[k]] += w * value[k];
+        }
+    }
+    else
+    {
+        for (int s = 0; s < S; ++s)
+        {
+            const double w = prior[s];
+            if (w == 0)
+                continue;
+            const double* row = &Transition[((size_t) action * S + s) * S];
+            for (int s2 = 0; s2 < S; ++s2)
+                out[s2] += w * row[s2];
+        }
+    }
+}
+
+bool POMDP::UpdateExactBelief(BELIEF_META_INFO& belief, int action,
+    observation_t observation) const
+{
+    if (observation >= NumObservations)
+        return false;
+
+    POMDP_METAINFO& meta = safe_cast<POMDP_METAINFO&>(belief);
+    const int S = NumStates;
+    vector<double> next;
+    Predict(action, meta.get_distribution(), next);
+
+    // Correct with the likelihood column of the observation
+    const double* likelihood = &Observation[((size_t) action * NumObservations + observation) * S];
+    double* out = next.data();
+    double total = 0;
+    for (int s2 = 0; s2 < S; ++s2)
+    {
+        out[s2] *= likelihood[s2];
+        total += out[s2];
+    }
+
+    if (total <= 0)
+        return false;
+
+    const double scale = 1.0 / total;
+    for (int s2 = 0; s2 < S; ++s2)
+        out[s2] *= scale;
+
+    meta.set_distribution(std::move(next), 1.0);
+    return true;
+}
+
+STATE* POMDP::CreateSample(const BELIEF_META_INFO& belief) const
+{
+    const POMDP_METAINFO& meta = safe_cast<const POMDP_METAINFO&>(belief);
+    POMDP_STATE* state = MemoryPool.Allocate();
+    state->State = meta.sample(random_state);
+    return state;
+}
+
+size_t POMDP::StateHash(const STATE& state) const
+{
+    return safe_cast<const POMDP_STATE&>(state).State;
+}
+
+bool POMDP::StateEquals(const STATE& state1, const STATE& state2) const
+{
+    return safe_cast<const POMDP_STATE&>(state1).State
+        == safe_cast<const POMDP_STATE&>(state2).State;
+}
+
+double POMDP::ObservationProbability(const STATE& state, int action,
+    observation_t observation) const
+{
+    const POMDP_STATE& pomdpState = safe_cast<const POMDP_STATE&>(state);
+    if (observation >= NumObservations)
+        return 0.0;
+    return Observation[((size_t) action * NumObservations + observation)
+        * NumStates + pomdpState.State];
+}
+
+void POMDP::set_belief_metainfo(VNODE *v, const SIMULATOR &) const
+{
+    v->Beliefs().set_metainfo(POMDP_METAINFO(NumStates), *this);
+}
+
+//-----------------------------------------------------------------------------
+
+void POMDP::DisplayBeliefs(const BELIEF_STATE& beliefState,
+    ostream& ostr) const
+{
+    const POMDP_METAINFO& meta =
+        safe_cast<const POMDP_METAINFO&>(beliefState.get_metainfo());
+    for (int s = 0; s < NumStates; ++s)
+    {
+        if (meta.get_prob(s) == 0)
+            continue;
+        ostr << (StateNames.empty() ? to_string(s) : StateNames[s])
+            << ": " << meta.get_prob(s) << endl;
+    }
+}
+
+void POMDP::DisplayState(const STATE& state, ostream& ostr) const
+{
+    const POMDP_STATE& pomdpState = safe_cast<const POMDP_STATE&>(state);
+    ostr << "State " << (StateNames.empty() ? to_string(pomdpState.State)
+        : StateNames[pomdpState.State]) << endl;
+}
+
+void POMDP::DisplayObservation(const STATE& state, observation_t observation,
+    ostream& ostr) const
+{
+    ostr << "Observation " << (ObservationNames.empty() ? to_string(observation)
+        : ObservationNames[observation]) << endl;
+}
+
+void POMDP::DisplayAction(int action, ostream& ostr) const
+{
+    ostr << "Action " << (ActionNames.empty() ? to_string(action)
+        : ActionNames[action]) << endl;
+}
+
+// xes
+void POMDP::log_problem_info() const
+{
+    XES::logger().add_attributes({
+            {"problem", "pomdp"},
+            {"states", NumStates},
+            {"actions", NumActions},
+            {"observations", (unsigned long) NumObservations},
+            {"RewardRange", RewardRange}
+        });
+}
+
+void POMDP::log_beliefs(const BELIEF_STATE& beliefState) const
+{
+    const POMDP_METAINFO& meta =
+        safe_cast<const POMDP_METAINFO&>(beliefState.get_metainfo());
+    XES::logger().start_list("belief");
+    for (int s = 0; s < NumStates; ++s)
+        if (meta.get_prob(s) > 0)
+            XES::logger().add_attribute({StateNames.empty() ? to_string(s)
+                : StateNames[s], meta.get_prob(s)});
+    XES::logger().end_list();
+}
+
+void POMDP::log_state(const STATE& state) const
+{
+    const POMDP_STATE& pomdpState = safe_cast<const POMDP_STATE&>(state);
+    XES::logger().add_attribute({"state", StateNames.empty()
+        ? to_string(pomdpState.State) : StateNames[pomdpState.State]});
+}
+
+void POMDP::log_action(int action) const
+{
+    XES::logger().add_attribute({"action", ActionNames.empty()
+        ? to_string(action) : ActionNames[action]});
+}
+
+void POMDP::log_observation(const STATE& state, observation_t observation) const
+{
+    XES::logger().add_attribute({"observation", ObservationNames.empty()
+        ? to_string(observation) : ObservationNames[observation]});
+}
+
+void POMDP::log_reward(double reward) const
+{
+    XES::logger().add_attribute({"reward", reward});
+}
+
+//-----------------------------------------------------------------------------
+
+void POMDP::UnitTest()
+{
+    istringstream model(
+        "discount: 0.95\n"
+        "values: reward\n"
+        "states: tiger-left tiger-right\n"
+        "actions: listen open-left open-right\n"
+        "observations: tiger-left tiger-right\n"
+        "start: uniform\n"
+        "T: listen\nidentity\n"
+        "T: open-left\nuniform\n"
+        "T: open-right\nuniform\n"
+        "O: listen\n0.85 0.15\n0.15 0.85\n"
+        "O: open-left\nuniform\n"
+        "O: open-right\nuniform\n"
+        "R: listen : * : * : * -1\n"
+        "R: open-left : tiger-left : * : * -100\n"
+        "R: open-left : tiger-right : * : * 10\n"
+        "R: open-right : tiger-left : * : * 10\n"
+        "R: open-right : tiger-right : * : * -100\n");
+    POMDP pomdp(model);
+    assert(pomdp.GetNumStates() == 2);
+    assert(pomdp.GetNumActions() == 3);
+    assert(pomdp.GetNumObservations() == 2);
+    assert(Near(pomdp.GetDiscount(), 0.95, 1e-9));
+    assert(Near(pomdp.GetRewardRange(), 110, 1e-9));
+
+    // Generative model
+    POMDP_STATE state;
+    state.State = 0;
+    SIMULATOR::observation_t observation;
+    double reward;
+    int correct = 0;
+    for (int i = 0; i < 10000; ++i)
+    {
+        pomdp.Step(state, 0, observation, reward);
+        assert(state.State == 0 && reward == -1);
+        if (observation == 0)
+            correct++;
+    }
+    assert(Near(correct, 8500, 250));
+    pomdp.Step(state, 1, observation, reward);
+    assert(reward == -100);
+
+    // Exact belief
+    BELIEF_META_INFO* belief = pomdp.CreateExactBelief();
+    const POMDP_METAINFO& meta = safe_cast<const POMDP_METAINFO&>(*belief);
+    (void) meta;
+    assert(Near(meta.get_prob(0), 0.5, 1e-9));
+    assert(pomdp.UpdateExactBelief(*belief, 0, 0));
+    assert(Near(meta.get_prob(0), 0.85, 1e-9));
+    assert(pomdp.UpdateExactBelief(*belief, 0, 0));
+    assert(Near(meta.get_prob(0), 0.85 * 0.85 / (0.85 * 0.85 + 0.15 * 0.15), 1e-9));
+    assert(pomdp.UpdateExactBelief(*belief, 1, 1));
+    assert(Near(meta.get_prob(0), 0.5, 1e-9));
+    pomdp.FreeMetainfo(belief);
+
+    // Alpha vectors
+    istringstream policy("0\n1 1\n1\n-100 10\n2\n10 -100\n");
+    pomdp.LoadPolicy(policy);
+    assert(pomdp.HasAlpha());
+    QNODE::NumChildren = pomdp.GetNumObservations();
+    QNODE qnode;
+    qnode.Initialise();
+    state.State = 1;
+    pomdp.UpdateAlpha(qnode, 1, state);
+    pomdp.UpdateAlpha(qnode, 1, state);
+    double q;
+    int n;
+    pomdp.AlphaValue(qnode, 1, q, n);
+    assert(n == 2 && Near(q, 10, 1e-9));
+}
@@ -0,0 +1,176 @@
+#ifndef POMDP_H
+#define POMDP_H
+
+#include "simulator.h"
+#include "aliastable.h"
+#include <algorithm>
+#include <istream>
+#include <string>
+#include <vector>
+
+class POMDP_STATE : public STATE
+{
+public:
+    int State;
+};
+
+// Distribution over the explicit states. Built from particles it is a
+// histogram (Total = number of particles); as an exact belief it is a
+// normalised probability vector (Total = 1).
+class POMDP_METAINFO : public BELIEF_META_INFO
+{
+public:
+    POMDP_METAINFO(int numStates) : prob(numStates, 0.0) {}
+
+    virtual void update(STATE *s, int count) {
+        auto pomdp_state = safe_cast<POMDP_STATE *>(s);
+        prob[pomdp_state->State] += count;
+        total += count;
+        sampler_valid = false;
+    }
+
+    virtual void clear() {
+        std::fill(prob.begin(), prob.end(), 0.0);
+        total = 0.0;
+        sampler_valid = false;
+    }
+
+    virtual BELIEF_META_INFO *clone() const {
+        return new POMDP_METAINFO(*this);
+    }
+
+    int get_num_states() const { return prob.size(); }
+    double get_total() const { return total; }
+    double get_prob(int s) const {
+        if (total == 0)
+            return 0.0;
+        else
+            return prob[s] / total;
+    }
+
+    const std::vector<double>& get_distribution() const { return prob; }
+    void set_distribution(std::vector<double>&& p, double t) {
+        prob = std::move(p);
+        total = t;
+        sampler_valid = false;
+    }
+
+    template<class RNG>
+    int sample(RNG& rng) const {
+        if (!sampler_valid) {
+            sampler.Build(prob);
+            sampler_valid = true;
+        }
+        return sampler.Sample(rng);
+    }
+
+private:
+    std::vector<double> prob;
+    double total = 0.0;
+
+    // rebuilt lazily, the exact belief changes once per real step
+    mutable ALIAS_TABLE sampler;
+    mutable bool sampler_valid = false;
+};
+
+// Explicit POMDP in Cassandra's .pomdp format, optionally with a set of
+// alpha vectors (.alpha format) used as value estimates inside the tree.
+class POMDP : public SIMULATOR
+{
+public:
+    POMDP(const std::string& modelFile);
+    POMDP(std::istream& model);
+
+    void LoadPolicy(const std::string& policyFile);
+    void LoadPolicy(std::istream& policy);
+
+    int GetNumStates() const { return NumStates; }
+
+    virtual STATE* Copy(const STATE& state) const;
+    virtual void Validate(const STATE& state) const;
+    virtual STATE* CreateStartState() const;
+    virtual void FreeState(STATE* state) const;
+    virtual bool Step(STATE& state, int action, observation_t& observation,
+        double& reward) const;
+
+    virtual bool HasAlpha() const;
+    virtual void AlphaValue(const QNODE& qnode, int action, double& q, int& n) const;
+    virtual void UpdateAlpha(QNODE& qnode, int action, const STATE& state) const;
+
+    virtual bool HasExactBelief() const { return true; }
+    virtual BELIEF_META_INFO* CreateExactBelief() const;
+    virtual bool UpdateExactBelief(BELIEF_META_INFO& belief, int action,
+        observation_t observation) const;
+    virtual STATE* CreateSample(const BELIEF_META_INFO& belief) const;
+
+    virtual bool HasStateHash() const { return true; }
+    virtual std::size_t StateHash(const STATE& state) const;
+    virtual bool StateEquals(const STATE& state1, const STATE& state2) const;
+    virtual bool HasObservationProbability() const { return true; }
+    virtual double ObservationProbability(const STATE& state, int action,
+        observation_t observation) const;
+
+    virtual void DisplayBeliefs(const BELIEF_STATE& beliefState,
+        std::ostream& ostr) const;
+    virtual void DisplayState(const STATE& state, std::ostream& ostr) const;
+    virtual void DisplayObservation(const STATE& state, observation_t observation,
+        std::ostream& ostr) const;
+    virtual void DisplayAction(int action, std::ostream& ostr) const;
+
+    virtual void log_problem_info() const;
+    virtual void log_beliefs(const BELIEF_STATE& beliefState) const;
+    virtual void log_state(const STATE& state) const;
+    virtual void log_action(int action) const;
+    virtual void log_observation(const STATE& state, observation_t observation) const;
+    virtual void log_reward(double reward) const;
+
+    virtual void set_belief_metainfo(VNODE *v, const SIMULATOR &s) const;
+    virtual void FreeMetainfo(BELIEF_META_INFO *m) const {
+        delete safe_cast<POMDP_METAINFO*>(m);
+    }
+
+    static void UnitTest();
+
+private:
+
+    struct REWARD_RULE
+    {
+        int Next, Obs; // -1 matches anything
+        double Value;
+    };
+
+    void Load(std::istream& model);
+    void Finalise();
+    double Reward(int action, int state, int next, int obs) const;
+    void Predict(int action, const std::vector<double>& prior,
+        std::vector<double>& next) const;
+
+    int NumStates;
+    bool Cost;
+    std::vector<std::string> StateNames, ActionNames, ObservationNames;
+
+    // Transition rows of (a, s): dense [(a * S + s) * S + s'] or CSR
+    bool SparseTransitions;
+    std::vector<double> Transition;
+    std::vector<int> RowStart, RowIndex;
+    std::vector<double> RowValue;
+
+    // Observation columns: [(a * O + o) * S + s'], contiguous in s'
+    std::vector<double> Observation;
+
+    // Rewards of (a, s), the last matching rule wins as in the file format
+    std::vector<std::vector<REWARD_RULE> > RewardRules;
+
+    std::vector<double> StartBelief;
+    ALIAS_TABLE StartSampler;
+    std::vector<ALIAS_TABLE> TransitionSampler;  // (a, s)  -> s'
+    std::vector<ALIAS_TABLE> ObservationSampler; // (a, s') -> o
+
+    // Alpha vectors [v * S + s], and the vectors tagged with each action
+    std::vector<double> AlphaVectors;
+    std::vector<std::vector<int> > AlphaIndex;
+
+    mutable MEMORY_POOL<POMDP_STATE> MemoryPool;
+};
+
+#endif // POMDP_H
@@ -7,6 +7,7 @@ REFUEL::REFUEL(int s, int e)
         NumActions = 5;
         //NumObservations = (1<<7)-1;
         NumObservations = 4;
+        NumMacros = stations.size() + 1; // move to each station, then target
         RewardRange = 20;
         Discount = 0.95;
       }
@@ -129,6 +130,28 @@ void REFUEL::GenerateLegal(const STATE& state, const HISTORY& history,
         legal.push_back(E_REFUEL);
 }
 
+int REFUEL::MacroAction(const STATE& state, int macro) const
+{
+    const REFUEL_STATE& rs = safe_cast<const REFUEL_STATE&>(state);
+    const COORD& goal = macro < (int) stations.size() ? stations[macro] : target;
+
+    // Horizontal moves first, a slip past the goal turns back
+    if (goal.X > rs.AgentPos.X)
+        return COORD::E_EAST;
+    if (goal.X < rs.AgentPos.X)
+        return COORD::E_WEST;
+    if (goal.Y > rs.AgentPos.Y)
+        return COORD::E_SOUTH;
+    if (goal.Y < rs.AgentPos.Y)
+        return COORD::E_NORTH;
+    return -1;
+}
+
+bool REFUEL::MacroCovers(int action) const
+{
+    return action < E_REFUEL;
+}
+
 void REFUEL::GeneratePreferred(const STATE& state, const HISTORY& history,
     std::vector<int>& actions, const STATUS& status) const {
     // TODO
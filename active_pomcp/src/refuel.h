@@ -175,6 +175,8 @@ public:
         std::vector<int>& legal, const STATUS& status) const;
     virtual bool LocalMove(STATE& state, const HISTORY& history,
         int stepObservation, const STATUS& status) const;
+    virtual int MacroAction(const STATE& state, int macro) const;
+    virtual bool MacroCovers(int action) const;
 
     virtual void DisplayBeliefs(const BELIEF_STATE& beliefState,
         std::ostream& ostr) const;
@@ -18,6 +18,7 @@ ROCKSAMPLE::ROCKSAMPLE(int size, int rocks)
     has_fixed_belief(false)
 {
     NumActions = NumRocks + 5;
+    NumMacros = NumRocks; // move to each rock and sample it
     NumObservations = 3;
     RewardRange = 20;
     Discount = 0.95;
@@ -45,6 +46,7 @@ ROCKSAMPLE::ROCKSAMPLE(int size, int rocks, int x, int y,
     fixed_belief(belief)
 {
     NumActions = NumRocks + 5;
+    NumMacros = NumRocks; // move to each rock and sample it
     NumObservations = 3;
     RewardRange = 20;
     Discount = 0.95;
@@ -72,6 +74,7 @@ ROCKSAMPLE::ROCKSAMPLE(int size, int rocks, std::string shield_file)
     has_fixed_belief(false)
 {
     NumActions = NumRocks + 5;
+    NumMacros = NumRocks; // move to each rock and sample it
     NumObservations = 3;
     RewardRange = 20;
     Discount = 0.95;
@@ -432,6 +435,17 @@ bool ROCKSAMPLE::Step(const VNODE *const mcts_root, STATE &state, int action,
     return Step(state, action, observation, reward);
 }
 
+double ROCKSAMPLE::EvaluateLeaf(const STATE& state, const HISTORY& history,
+    int depth) const
+{
+    const ROCKSAMPLE_STATE& rockstate =
+        safe_cast<const ROCKSAMPLE_STATE&>(state);
+
+    // Lower bound: head straight east and take the exit reward, ignoring
+    // the rocks that are still to be sampled
+    return 10.0 * pow(Discount, Size - 1 - rockstate.AgentPos.X);
+}
+
 bool ROCKSAMPLE::LocalMove(STATE& state, const HISTORY& history,
     int stepObs, const STATUS& status) const
 {
@@ -458,44 +472,292 @@ bool ROCKSAMPLE::LocalMove(STATE& state, const HISTORY& history,
     return true;
 }
 
+BELIEF_META_INFO* ROCKSAMPLE::CreateExactBelief() const
+{
+    std::vector<double> prior(NumRocks, 0.5);
+    if (has_fixed_belief)
+        prior = fixed_belief;
+
+    ROCKSAMPLE_STATE* start = safe_cast<ROCKSAMPLE_STATE*>(CreateStartState());
+    ROCKSAMPLE_EXACT_METAINFO* belief = new ROCKSAMPLE_EXACT_METAINFO(*start, prior);
+    FreeState(start);
+    return belief;
+}
+
+bool ROCKSAMPLE::UpdateExactBelief(BELIEF_META_INFO& belief, int action,
+    observation_t observation) const
+{
+    ROCKSAMPLE_EXACT_METAINFO& meta = safe_cast<ROCKSAMPLE_EXACT_METAINFO&>(belief);
+    ROCKSAMPLE_STATE& known = meta.known;
+
+    if (action < E_SAMPLE) // move, deterministic
+    {
+        if (observation != E_NONE)
+            return false;
+        switch (action)
+        {
+            case COORD::E_EAST:
+                if (known.AgentPos.X + 1 < Size)
+                    known.AgentPos.X++;
+                break;
+            case COORD::E_NORTH:
+                if (known.AgentPos.Y + 1 < Size)
+                    known.AgentPos.Y++;
+                break;
+            case COORD::E_SOUTH:
+                if (known.AgentPos.Y - 1 >= 0)
+                    known.AgentPos.Y--;
+                break;
+            case COORD::E_WEST:
+                if (known.AgentPos.X - 1 >= 0)
+                    known.AgentPos.X--;
+                break;
+        }
+    }
+
+    if (action == E_SAMPLE)
+    {
+        if (observation != E_NONE)
+            return false;
+        int rock = Grid(known.AgentPos);
+        if (rock >= 0)
+            known.Rocks[rock].Collected = true;
+    }
+
+    if (action > E_SAMPLE) // check, Bayes update of a single marginal
+    {
+        if (observation == E_NONE)
+            return false;
+        int rock = action - E_SAMPLE - 1;
+        ROCKSAMPLE_STATE::ENTRY& entry = known.Rocks[rock];
+        double distance = COORD::EuclideanDistance(known.AgentPos, RockPos[rock]);
+        double efficiency = (1 + pow(2, -distance / HalfEfficiencyDistance)) * 0.5;
+        double likelihoodValuable = observation == E_GOOD ? efficiency : 1.0 - efficiency;
+        double likelihoodWorthless = 1.0 - likelihoodValuable;
+
+        double p = meta.get_prob_valuable(rock);
+        double denom = p * likelihoodValuable + (1.0 - p) * likelihoodWorthless;
+        if (denom <= 0)
+            return false;
+        meta.set_prob_valuable(rock, p * likelihoodValuable / denom);
+
+        // Smart knowledge, as in Step
+        entry.Measured++;
+        entry.Count += observation == E_GOOD ? 1 : -1;
+        entry.LikelihoodValuable *= likelihoodValuable;
+        entry.LikelihoodWorthless *= likelihoodWorthless;
+        entry.ProbValuable = (0.5 * entry.LikelihoodValuable) /
+            (0.5 * entry.LikelihoodValuable + 0.5 * entry.LikelihoodWorthless);
+    }
+
+    if (known.Target < 0 || known.AgentPos == RockPos[known.Target])
+        known.Target = SelectTarget(known);
+    meta.sync_known();
+    return true;
+}
+
+STATE* ROCKSAMPLE::CreateSample(const BELIEF_META_INFO& belief) const
+{
+    const ROCKSAMPLE_EXACT_METAINFO& meta =
+        safe_cast<const ROCKSAMPLE_EXACT_METAINFO&>(belief);
+    ROCKSAMPLE_STATE* rockstate = MemoryPool.Allocate();
+    rockstate->AgentPos = meta.known.AgentPos;
+    rockstate->Rocks = meta.known.Rocks;
+    rockstate->Target = meta.known.Target;
+    for (int rock = 0; rock < NumRocks; ++rock)
+        rockstate->Rocks[rock].Valuable =
+            unif_dist(random_state) <= meta.get_prob_valuable(rock);
+    return rockstate;
+}
+
+uint64_t ROCKSAMPLE::HistoryKey(const STATE& state, int action,
+    observation_t observation) const
+{
+    // Only checks carry information, and the posterior of a rock depends on
+    // the multiset of (distance, outcome) of its checks, not on their order
+    if (action <= E_SAMPLE)
+        return 0;
+    const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(state);
+    int rock = action - E_SAMPLE - 1;
+    int dx = rockstate.AgentPos.X - RockPos[rock].X;
+    int dy = rockstate.AgentPos.Y - RockPos[rock].Y;
+    uint64_t distance2 = dx * dx + dy * dy;
+    return Mix64((uint64_t(rock) << 32) | (distance2 << 2) | observation);
+}
+
+uint64_t ROCKSAMPLE::ObservedHash(const STATE& state) const
+{
+    const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(state);
+    uint64_t hash = rockstate.AgentPos.X * Size + rockstate.AgentPos.Y;
+    for (int rock = 0; rock < NumRocks; ++rock)
+        hash = hash * 2 + (rockstate.Rocks[rock].Collected ? 1 : 0);
+    return Mix64(hash);
+}
+
+size_t ROCKSAMPLE::StateHash(const STATE& state) const
+{
+    const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(state);
+    size_t hash = rockstate.AgentPos.X * Size + rockstate.AgentPos.Y;
+    for (int rock = 0; rock < NumRocks; ++rock)
+    {
+        hash = hash * 4 + (rockstate.Rocks[rock].Valuable ? 1 : 0)
+            + (rockstate.Rocks[rock].Collected ? 2 : 0);
+    }
+    return hash;
+}
+
+bool ROCKSAMPLE::StateEquals(const STATE& state1, const STATE& state2) const
+{
+    // Smart knowledge fields take part too, so merged states behave the same
+    const ROCKSAMPLE_STATE& s1 = safe_cast<const ROCKSAMPLE_STATE&>(state1);
+    const ROCKSAMPLE_STATE& s2 = safe_cast<const ROCKSAMPLE_STATE&>(state2);
+    if (!(s1.AgentPos == s2.AgentPos) || s1.Target != s2.Target)
+        return false;
+    for (int rock = 0; rock < NumRocks; ++rock)
+    {
+        const ROCKSAMPLE_STATE::ENTRY& r1 = s1.Rocks[rock];
+        const ROCKSAMPLE_STATE::ENTRY& r2 = s2.Rocks[rock];
+        if (r1.Valuable != r2.Valuable || r1.Collected != r2.Collected
+            || r1.Count != r2.Count || r1.Measured != r2.Measured
+            || r1.LikelihoodValuable != r2.LikelihoodValuable
+            || r1.LikelihoodWorthless != r2.LikelihoodWorthless)
+            return false;
+    }
+    return true;
+}
+
+double ROCKSAMPLE::ObservationProbability(const STATE& state, int action,
+    observation_t observation) const
+{
+    const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(state);
+    if (action <= E_SAMPLE)
+        return observation == E_NONE ? 1.0 : 0.0;
+    if (observation == E_NONE)
+        return 0.0;
+
+    int rock = action - E_SAMPLE - 1;
+    double distance = COORD::EuclideanDistance(rockstate.AgentPos, RockPos[rock]);
+    double efficiency = (1.0 + pow(2, -distance / HalfEfficiencyDistance)) * 0.5;
+    bool good = observation == E_GOOD;
+    return rockstate.Rocks[rock].Valuable == good ? efficiency : 1.0 - efficiency;
+}
+
+void ROCKSAMPLE::SetObservation(STATE& state, int action,
+    observation_t stepObs, observation_t realObs) const
+{
+    if (action <= E_SAMPLE || stepObs == realObs)
+        return;
+
+    ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(state);
+    int rock = action - E_SAMPLE - 1;
+    ROCKSAMPLE_STATE::ENTRY& entry = rockstate.Rocks[rock];
+
+    // Same correction of the counts as LocalMove
+    entry.Count += realObs == E_GOOD ? 2 : -2;
+
+    // Swap the likelihood factor of the sampled observation for the real one
+    double distance = COORD::EuclideanDistance(rockstate.AgentPos, RockPos[rock]);
+    double efficiency = (1.0 + pow(2, -distance / HalfEfficiencyDistance)) * 0.5;
+    if (efficiency >= 1.0)
+        return; // real observation is impossible, particle has no weight
+    double ratio = efficiency / (1.0 - efficiency);
+    if (realObs == E_GOOD)
+    {
+        entry.LikelihoodValuable *= ratio;
+        entry.LikelihoodWorthless /= ratio;
+    }
+    else
+    {
+        entry.LikelihoodValuable /= ratio;
+        entry.LikelihoodWorthless *= ratio;
+    }
+    double denom = (0.5 * entry.LikelihoodValuable) +
+        (0.5 * entry.LikelihoodWorthless);
+    entry.ProbValuable = (0.5 * entry.LikelihoodValuable) / denom;
+}
+
 void ROCKSAMPLE::GenerateLegal(const STATE& state, const HISTORY& history,
     vector<int>& legal, const STATUS& status) const
 {
+    MaskToActions(LegalMask(state, history, status), legal);
+}
+
+void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
+    vector<int>& actions, const STATUS& status) const
+{
+    MaskToActions(PreferredMask(state, history, status), actions);
+}
+
+int ROCKSAMPLE::MacroAction(const STATE& state, int macro) const
+{
+    const ROCKSAMPLE_STATE& rockstate =
+        safe_cast<const ROCKSAMPLE_STATE&>(state);
+
+    // Shortest path to the rock, horizontal moves first, then check it from
+    // there, which is exact, and sample it if it is valuable. The belief
+    // of the rock is read from the observations, never from Valuable.
+    // Exiting is left to the primitive E_EAST.
+    const ROCKSAMPLE_STATE::ENTRY& rock = rockstate.Rocks[macro];
+    if (rock.Collected || rock.ProbValuable == 0)
+        return -1;
+    const COORD& target = RockPos[macro];
+    if (target.X > rockstate.AgentPos.X)
+        return COORD::E_EAST;
+    if (target.X < rockstate.AgentPos.X)
+        return COORD::E_WEST;
+    if (target.Y > rockstate.AgentPos.Y)
+        return COORD::E_NORTH;
+    if (target.Y < rockstate.AgentPos.Y)
+        return COORD::E_SOUTH;
+    if (rock.ProbValuable == 1)
+        return E_SAMPLE;
+    return E_SAMPLE + 1 + macro;
+}
+
+bool ROCKSAMPLE::MacroCovers(int action) const
+{
+    return action < E_SAMPLE && action != COORD::E_EAST;
+}
 
+uint64_t ROCKSAMPLE::LegalMask(const STATE& state, const HISTORY& history,
+    const STATUS& status) const
+{
     const ROCKSAMPLE_STATE& rockstate =
         safe_cast<const ROCKSAMPLE_STATE&>(state);
+    assert(NumActions <= 64);
+    uint64_t legal = 0;
 
     if (rockstate.AgentPos.Y + 1 < Size)
-        legal.push_back(COORD::E_NORTH);
+        legal |= 1ULL << COORD::E_NORTH;
 
-    legal.push_back(COORD::E_EAST);
+    legal |= 1ULL << COORD::E_EAST;
 
     if (rockstate.AgentPos.Y - 1 >= 0)
-        legal.push_back(COORD::E_SOUTH);
+        legal |= 1ULL << COORD::E_SOUTH;
 
     if (rockstate.AgentPos.X - 1 >= 0)
-        legal.push_back(COORD::E_WEST);
+        legal |= 1ULL << COORD::E_WEST;
 
     int rock = Grid(rockstate.AgentPos);
     if (rock >= 0 && !rockstate.Rocks[rock].Collected)
-        legal.push_back(E_SAMPLE);
+        legal |= 1ULL << E_SAMPLE;
 
     for (rock = 0; rock < NumRocks; ++rock)
         if (!rockstate.Rocks[rock].Collected)
-            legal.push_back(rock + 1 + E_SAMPLE);
+            legal |= 1ULL << (rock + 1 + E_SAMPLE);
+    return legal;
 }
 
-void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
-    vector<int>& actions, const STATUS& status) const
+uint64_t ROCKSAMPLE::PreferredMask(const STATE& state, const HISTORY& history,
+    const STATUS& status) const
 {
     static const bool UseBlindPolicy = false;
 
-    if (UseBlindPolicy) {
-        actions.push_back(COORD::E_EAST);
-        return;
-    }
+    if (UseBlindPolicy)
+        return 1ULL << COORD::E_EAST;
 
     const auto& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(state);
+    uint64_t actions = 0;
 
     // Sample rocks with more +ve than -ve observations
     int rock = Grid(rockstate.AgentPos);
@@ -510,10 +772,8 @@ void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
                     total--;
             }
         }
-        if (total > 0) {
-            actions.push_back(E_SAMPLE);
-            return;
-        }
+        if (total > 0)
+            return 1ULL << E_SAMPLE;
     }
 
     // processes the rocks
@@ -552,10 +812,8 @@ void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
     }
 
     // if all remaining rocks seem bad, then head east
-    if (all_bad) {
-        actions.push_back(COORD::E_EAST);
-        return;
-    }
+    if (all_bad)
+        return 1ULL << COORD::E_EAST;
 
     // generate a random legal move, with the exceptions that:
     //   a) there is no point measuring a rock that is already collected
@@ -565,16 +823,16 @@ void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
     //   e) we never move in a direction that doesn't take us closer to
     //      either the edge of the map or an interesting rock
     if (rockstate.AgentPos.Y + 1 < Size && north_interesting)
-        actions.push_back(COORD::E_NORTH);
+        actions |= 1ULL << COORD::E_NORTH;
 
     if (east_interesting)
-        actions.push_back(COORD::E_EAST);
+        actions |= 1ULL << COORD::E_EAST;
 
     if (rockstate.AgentPos.Y - 1 >= 0 && south_interesting)
-        actions.push_back(COORD::E_SOUTH);
+        actions |= 1ULL << COORD::E_SOUTH;
 
     if (rockstate.AgentPos.X - 1 >= 0 && west_interesting)
-        actions.push_back(COORD::E_WEST);
+        actions |= 1ULL << COORD::E_WEST;
 
     for (rock = 0; rock < NumRocks; ++rock) {
         if (!rockstate.Rocks[rock].Collected &&
@@ -583,9 +841,10 @@ void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
             rockstate.Rocks[rock].Measured < 5 &&
             std::abs(rockstate.Rocks[rock].Count) < 2
             ) {
-            actions.push_back(rock + 1 + E_SAMPLE);
+            actions |= 1ULL << (rock + 1 + E_SAMPLE);
         }
     }
+    return actions;
 }
 
 int ROCKSAMPLE::GetObservation(const ROCKSAMPLE_STATE& rockstate, int rock) const
@@ -709,11 +968,7 @@ void ROCKSAMPLE::log_beliefs(const BELIEF_STATE& beliefState) const {
         for (int j = 0; j<rockstate.Rocks.size(); j++) {
             id += rockstate.Rocks[j].Valuable ? pow2(j) : 0;
         }
-        // If it is not in dist then add it and initialize to 1
-        if (dist.find(id) == dist.end())
-            dist[id]= 1;
-        else
-            dist[id]++;
+        dist[id] += beliefState.GetCount(i);
     }
 
     const STATE* state = beliefState.GetSample(0);
@@ -797,17 +1052,16 @@ void ROCKSAMPLE::set_belief_metainfo(VNODE *v, const SIMULATOR &) const {
 }
 
 void ROCKSAMPLE::pre_shield(const BELIEF_STATE &belief, std::vector<int> &legal_actions) const {
-    const STATE* state = belief.GetSample(0);
-    const auto& rs = safe_cast<const ROCKSAMPLE_STATE&>(*state);
     const auto& meta =
         dynamic_cast<const ROCKSAMPLE_METAINFO&>(belief.get_metainfo());
+    COORD pos(meta.x(), meta.y());
 
     // moving is always legal
-    if (rs.AgentPos.Y - 1 >= 0)
+    if (pos.Y - 1 >= 0)
         legal_actions.push_back(COORD::E_SOUTH);
-    if (rs.AgentPos.Y + 1 < Size)
+    if (pos.Y + 1 < Size)
         legal_actions.push_back(COORD::E_NORTH);
-    if (rs.AgentPos.X - 1 >= 0)
+    if (pos.X - 1 >= 0)
         legal_actions.push_back(COORD::E_WEST);
     legal_actions.push_back(COORD::E_EAST);
                
@@ -818,14 +1072,23 @@ void ROCKSAMPLE::pre_shield(const BELIEF_STATE &belief, std::vector<int> &legal_
     }
 
     // only sample if safe
-    int rock = Grid(rs.AgentPos);
-    if (rock >= 0 && !rs.Rocks[rock].Collected) {
-        double p = meta.get_prob_valuable(rock);
-        if (p >= sample_shield_tr)
-            legal_actions.push_back(E_SAMPLE);
-        else if (sampling_points.is_in_threshold({p}))
-            legal_actions.push_back(E_SAMPLE);
-    }
+    int rock = Grid(pos);
+    if (rock >= 0 && !meta.collected(rock)
+            && sample_rule(meta.get_prob_valuable(rock)))
+        legal_actions.push_back(E_SAMPLE);
+}
+
+bool ROCKSAMPLE::sample_rule(double p) const {
+    return p >= sample_shield_tr || sampling_points.is_in_threshold({p});
+}
+
+void ROCKSAMPLE::RuleActions(const BELIEF_STATE &belief, std::vector<int> &actions) const {
+    const auto& meta =
+        dynamic_cast<const ROCKSAMPLE_METAINFO&>(belief.get_metainfo());
+    int rock = Grid(COORD(meta.x(), meta.y()));
+    if (rock >= 0 && !meta.collected(rock)
+            && sample_rule(meta.get_prob_valuable(rock)))
+        actions.push_back(E_SAMPLE);
 }
 
 Classification ROCKSAMPLE::check_rule(const BELIEF_META_INFO &m, int a, double t) const {
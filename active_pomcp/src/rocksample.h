@@ -67,24 +67,35 @@ void from_json(const nlohmann::json& j, ROCKSAMPLE_STATE& p) {
 class ROCKSAMPLE_METAINFO : public BELIEF_META_INFO
 {
 public:
-    ROCKSAMPLE_METAINFO(int NumRocks): distr(NumRocks, 0), collected_() {}
+    ROCKSAMPLE_METAINFO(int NumRocks): distr(NumRocks, 0.0), collected_() {}
 
-    virtual void update(STATE *s) {
+    virtual void update(STATE *s, int count) {
         const ROCKSAMPLE_STATE& state = safe_cast<const ROCKSAMPLE_STATE&>(*s);
-        ++total;
+        total += count;
 
         for (size_t i = 0; i < state.Rocks.size(); i++) {
             if (state.Rocks[i].Valuable)
-                distr[i] += 1;
+                distr[i] += count;
         }
-        x_ = state.AgentPos.X;
-        y_ = state.AgentPos.Y;
+        update_known(state);
+    }
 
-        if (collected_.empty()) {
-            for (size_t i = 0; i < state.Rocks.size(); i++) {
-                collected_.push_back(state.Rocks[i].Collected? 1 : 0);
-            }
+    virtual void update_all(const std::vector<STATE *> &states,
+                            const std::vector<int> &counts) {
+        if (states.empty())
+            return;
+        // Accumulate locally, the particles never alias distr
+        const int num = distr.size();
+        double *acc = distr.data();
+        for (size_t p = 0; p < states.size(); p++) {
+            const auto &rocks =
+                safe_cast<const ROCKSAMPLE_STATE *>(states[p])->Rocks;
+            const double c = counts[p];
+            total += c;
+            for (int i = 0; i < num; i++)
+                acc[i] += rocks[i].Valuable ? c : 0.0;
         }
+        update_known(safe_cast<const ROCKSAMPLE_STATE &>(*states.back()));
     }
 
     virtual void clear() {
@@ -96,27 +107,90 @@ public:
         collected_.clear();
     }
 
-    int get_total() const { return total; }
+    double get_total() const { return total; }
+    int num_rocks() const { return distr.size(); }
     double get_prob_valuable(int rock) const { 
-        return static_cast<double>(distr[rock]) / total;
+        return distr[rock] / total;
     }
 
     virtual BELIEF_META_INFO *clone() const {
         return new ROCKSAMPLE_METAINFO(*this);
     }
 
+    // Mean binary entropy of the rocks not collected yet
+    virtual double entropy() const {
+        if (total <= 0)
+            return -1;
+        double sum = 0;
+        int n = 0;
+        for (size_t i = 0; i < distr.size(); i++) {
+            if (!collected_.empty() && collected_[i])
+                continue;
+            double p = distr[i] / total;
+            if (p > 0 && p < 1)
+                sum -= p * std::log2(p) + (1 - p) * std::log2(1 - p);
+            n++;
+        }
+        return n > 0 ? sum / n : 0;
+    }
+
     const std::vector<int> &collected() const { return collected_; }
     bool collected(int rock) const { return collected_[rock] == 1; }
     int x() const { return x_; }
     int y() const { return y_; }
 
-private:
-    std::vector<int> distr;
+protected:
+    void update_known(const ROCKSAMPLE_STATE &state) {
+        x_ = state.AgentPos.X;
+        y_ = state.AgentPos.Y;
+
+        if (collected_.empty()) {
+            for (size_t i = 0; i < state.Rocks.size(); i++) {
+                collected_.push_back(state.Rocks[i].Collected? 1 : 0);
+            }
+        }
+    }
+
+    // valuable counts, or marginal probabilities with total = 1
+    std::vector<double> distr;
     std::vector<int> collected_;
-    int total = 0;
+    double total = 0;
     int x_ = 0, y_ = 0;
 };
 
+// Exact factored belief: given the agent position, which is fully observed,
+// rocks stay independent, so the marginals in distr are the whole belief.
+// known holds the part of the state fixed by the history (position,
+// collected rocks, smart knowledge); its Valuable flags are not used.
+class ROCKSAMPLE_EXACT_METAINFO : public ROCKSAMPLE_METAINFO
+{
+public:
+    ROCKSAMPLE_EXACT_METAINFO(const ROCKSAMPLE_STATE& start,
+        const std::vector<double>& prior) :
+        ROCKSAMPLE_METAINFO(prior.size()), known(start) {
+        distr = prior;
+        total = 1.0;
+        sync_known();
+    }
+
+    void set_prob_valuable(int rock, double p) { distr[rock] = p; }
+
+    // refresh position and collected flags from known
+    void sync_known() {
+        x_ = known.AgentPos.X;
+        y_ = known.AgentPos.Y;
+        collected_.clear();
+        for (size_t i = 0; i < known.Rocks.size(); i++)
+            collected_.push_back(known.Rocks[i].Collected ? 1 : 0);
+    }
+
+    virtual BELIEF_META_INFO *clone() const {
+        return new ROCKSAMPLE_EXACT_METAINFO(*this);
+    }
+
+    ROCKSAMPLE_STATE known;
+};
+
 
 
 class ROCKSAMPLE : public SIMULATOR
@@ -141,8 +215,35 @@ public:
         std::vector<int>& legal, const STATUS& status) const;
     void GeneratePreferred(const STATE& state, const HISTORY& history,
         std::vector<int>& legal, const STATUS& status) const;
+    virtual bool HasActionMask() const { return true; }
+    virtual uint64_t LegalMask(const STATE& state, const HISTORY& history,
+        const STATUS& status) const;
+    virtual uint64_t PreferredMask(const STATE& state, const HISTORY& history,
+        const STATUS& status) const;
+    virtual int MacroAction(const STATE& state, int macro) const;
+    virtual bool MacroCovers(int action) const;
     virtual bool LocalMove(STATE& state, const HISTORY& history,
         int stepObservation, const STATUS& status) const;
+    virtual double EvaluateLeaf(const STATE& state, const HISTORY& history,
+        int depth) const;
+
+    virtual bool HasHistorySignature() const { return true; }
+    virtual uint64_t HistoryKey(const STATE& state, int action,
+        observation_t observation) const;
+    virtual uint64_t ObservedHash(const STATE& state) const;
+    virtual bool HasStateHash() const { return true; }
+    virtual std::size_t StateHash(const STATE& state) const;
+    virtual bool StateEquals(const STATE& state1, const STATE& state2) const;
+    virtual bool HasExactBelief() const { return true; }
+    virtual BELIEF_META_INFO* CreateExactBelief() const;
+    virtual bool UpdateExactBelief(BELIEF_META_INFO& belief, int action,
+        observation_t observation) const;
+    virtual STATE* CreateSample(const BELIEF_META_INFO& belief) const;
+    virtual bool HasObservationProbability() const { return true; }
+    virtual double ObservationProbability(const STATE& state, int action,
+        observation_t observation) const;
+    virtual void SetObservation(STATE& state, int action,
+        observation_t stepObservation, observation_t observation) const;
 
     virtual void DisplayBeliefs(const BELIEF_STATE& beliefState,
         std::ostream& ostr) const;
@@ -164,6 +265,7 @@ public:
         delete m;
     }
     virtual void pre_shield(const BELIEF_STATE &belief, std::vector<int> &legal_actions) const;
+    virtual void RuleActions(const BELIEF_STATE &belief, std::vector<int> &actions) const;
 
     virtual Classification check_rule(const BELIEF_META_INFO &m, int a, double t) const;
 
@@ -200,8 +302,9 @@ protected:
 private:
     mutable MEMORY_POOL<ROCKSAMPLE_STATE> MemoryPool;
 
-    hellinger_shield<1> sampling_points;
+    hellinger_tree<1> sampling_points;
     double sample_shield_tr;
+    bool sample_rule(double p) const;
     mutable std::uniform_real_distribution<> unif_dist;
     bool has_fixed_belief;
     std::vector<double> fixed_belief;
@@ -15,14 +15,11 @@ public:
         const auto &info =
             safe_cast<const ROCKSAMPLE_METAINFO &>(b.get_metainfo());
 
-        const auto *state =
-            safe_cast<const ROCKSAMPLE_STATE *>(b.GetSample(0));
-
-        for (int i = 0; i < state->Rocks.size(); i++)
+        for (int i = 0; i < info.num_rocks(); i++)
             rock_probs_.push_back(info.get_prob_valuable(i));
 
-        x_ = state->AgentPos.X;
-        y_ = state->AgentPos.Y;
+        x_ = info.x();
+        y_ = info.y();
     }
 
     void build_from_json(std::vector<double> r, int x, int y) {
@@ -72,19 +69,17 @@ public:
         const auto &info =
             safe_cast<const ROCKSAMPLE_METAINFO &>(b.get_metainfo());
 
-        const auto *state =
-            safe_cast<const ROCKSAMPLE_STATE *>(b.GetSample(0));
-
-        for (int i = 0; i < state->Rocks.size(); i++)
+        for (int i = 0; i < info.num_rocks(); i++)
             rock_probs_.push_back(info.get_prob_valuable(i));
 
-        x_ = state->AgentPos.X;
-        y_ = state->AgentPos.Y;
+        x_ = info.x();
+        y_ = info.y();
 
         for (int i = 0; i < b.GetNumSamples(); i++) {
             const auto *state =
                 safe_cast<const ROCKSAMPLE_STATE *>(b.GetSample(i));
-            particles_.emplace_back(*state);
+            for (int c = 0; c < b.GetCount(i); c++)
+                particles_.emplace_back(*state);
         }
     }
 
@@ -7,7 +7,9 @@ SIMULATOR::KNOWLEDGE::KNOWLEDGE()
 :   TreeLevel(LEGAL),
     RolloutLevel(LEGAL),
     SmartTreeCount(10),
-    SmartTreeValue(1.0)
+    SmartTreeValue(1.0),
+    RuleTreeCount(0),
+    RuleTreeValue(0.0)
 {
 }
 
@@ -47,6 +49,32 @@ bool SIMULATOR::LocalMove(STATE& state, const HISTORY& history,
     return true;
 }
 
+double SIMULATOR::EvaluateLeaf(const STATE& state, const HISTORY& history,
+    int depth) const
+{
+    return 0;
+}
+
+double SIMULATOR::ExpectedReward(const STATE& state, int action) const
+{
+    return 0;
+}
+
+int SIMULATOR::MacroAction(const STATE& state, int macro) const
+{
+    return -1;
+}
+
+bool SIMULATOR::MacroCovers(int action) const
+{
+    return false;
+}
+
+STATE* SIMULATOR::ConvertState(const STATE& state) const
+{
+    return Copy(state);
+}
+
 void SIMULATOR::GenerateLegal(const STATE& state, const HISTORY& history, 
     std::vector<int>& actions, const STATUS& status) const
 {
@@ -59,11 +87,108 @@ void SIMULATOR::GeneratePreferred(const STATE& state, const HISTORY& history,
 {
 }
 
+uint64_t SIMULATOR::LegalMask(const STATE& state, const HISTORY& history,
+    const STATUS& status) const
+{
+    assert(NumActions <= 64);
+    return NumActions == 64 ? ~0ULL : (1ULL << NumActions) - 1;
+}
+
+uint64_t SIMULATOR::PreferredMask(const STATE& state, const HISTORY& history,
+    const STATUS& status) const
+{
+    return 0;
+}
+
+void SIMULATOR::MaskToActions(uint64_t mask, vector<int>& actions)
+{
+    for (; mask; mask &= mask - 1)
+        actions.push_back(__builtin_ctzll(mask));
+}
+
+void SIMULATOR::UnitTestActionMask(SIMULATOR& simulator)
+{
+    assert(simulator.HasActionMask());
+    HISTORY history;
+    STATUS status;
+    KNOWLEDGE knowledge = simulator.Knowledge;
+    vector<int> legal, preferred, actions;
+
+    STATE* state = simulator.CreateStartState();
+    for (int i = 0; i < 1000; i++)
+    {
+        legal.clear();
+        simulator.GenerateLegal(*state, history, legal, status);
+        sort(legal.begin(), legal.end());
+        actions.clear();
+        MaskToActions(simulator.LegalMask(*state, history, status), actions);
+        assert(actions == legal);
+
+        preferred.clear();
+        simulator.GeneratePreferred(*state, history, preferred, status);
+        sort(preferred.begin(), preferred.end());
+        actions.clear();
+        MaskToActions(simulator.PreferredMask(*state, history, status), actions);
+        assert(actions == preferred);
+
+        // The vector path, with the same random numbers
+        for (int level : { KNOWLEDGE::LEGAL, KNOWLEDGE::SMART })
+        {
+            simulator.Knowledge.RolloutLevel = level;
+            srand(i);
+            int action = simulator.SelectRandom(*state, history, status);
+            srand(i);
+            int expected;
+            if (level == KNOWLEDGE::SMART && !preferred.empty())
+                expected = preferred[Random(preferred.size())];
+            else if (!legal.empty())
+                expected = legal[Random(legal.size())];
+            else
+                expected = Random(simulator.NumActions);
+            assert(action == expected);
+            (void) action;
+            (void) expected;
+        }
+
+        observation_t observation;
+        double reward;
+        int action = legal.empty() ? Random(simulator.NumActions)
+            : legal[Random(legal.size())];
+        if (simulator.Step(*state, action, observation, reward))
+        {
+            simulator.FreeState(state);
+            state = simulator.CreateStartState();
+        }
+    }
+    simulator.FreeState(state);
+    simulator.Knowledge = knowledge;
+}
+
 int SIMULATOR::SelectRandom(const STATE& state, const HISTORY& history,
     const STATUS& status) const
 {
     static vector<int> actions;
 
+    if (HasActionMask())
+    {
+        uint64_t mask;
+        if (Knowledge.RolloutLevel >= KNOWLEDGE::SMART)
+        {
+            mask = PreferredMask(state, history, status);
+            if (mask)
+                return SelectBit(mask, Random(CountBits(mask)));
+        }
+
+        if (Knowledge.RolloutLevel >= KNOWLEDGE::LEGAL)
+        {
+            mask = LegalMask(state, history, status);
+            if (mask)
+                return SelectBit(mask, Random(CountBits(mask)));
+        }
+
+        return Random(NumActions);
+    }
+
     if (Knowledge.RolloutLevel >= KNOWLEDGE::SMART)
     {
         actions.clear();
@@ -127,16 +252,111 @@ void SIMULATOR::Prior(const STATE* state, const HISTORY& history,
     }
 }
 
+void SIMULATOR::RulePrior(const BELIEF_STATE& belief, VNODE* vnode) const
+{
+    static vector<int> actions;
+
+    actions.clear();
+    RuleActions(belief, actions);
+    for (int a : actions)
+    {
+        QNODE& qnode = vnode->Child(a);
+        if (qnode.Value.GetCount() >= LargeInteger) // illegal
+            continue;
+        qnode.Value.Add(Knowledge.RuleTreeValue, Knowledge.RuleTreeCount);
+        qnode.AMAF.Add(Knowledge.RuleTreeValue, Knowledge.RuleTreeCount);
+    }
+}
+
+void SIMULATOR::RuleActions(const BELIEF_STATE& belief,
+    vector<int>& actions) const
+{
+}
+
 bool SIMULATOR::HasAlpha() const
 {
     return false;
 }
 
-void SIMULATOR::AlphaValue(const QNODE& qnode, double& q, int& n) const
+void SIMULATOR::AlphaValue(const QNODE& qnode, int action, double& q, int& n) const
+{
+}
+
+void SIMULATOR::UpdateAlpha(QNODE& qnode, int action, const STATE& state) const
+{
+}
+
+bool SIMULATOR::HasExactBelief() const
+{
+    return false;
+}
+
+BELIEF_META_INFO* SIMULATOR::CreateExactBelief() const
+{
+    return 0;
+}
+
+bool SIMULATOR::UpdateExactBelief(BELIEF_META_INFO& belief, int action,
+    observation_t observation) const
+{
+    return false;
+}
+
+STATE* SIMULATOR::CreateSample(const BELIEF_META_INFO& belief) const
+{
+    return 0;
+}
+
+bool SIMULATOR::HasStateHash() const
+{
+    return false;
+}
+
+size_t SIMULATOR::StateHash(const STATE& state) const
+{
+    return 0;
+}
+
+bool SIMULATOR::StateEquals(const STATE& state1, const STATE& state2) const
+{
+    return &state1 == &state2;
+}
+
+SIMULATOR::observation_t SIMULATOR::AbstractObservation(
+    observation_t observation, const HISTORY& history) const
+{
+    return observation;
+}
+
+bool SIMULATOR::HasHistorySignature() const
+{
+    return false;
+}
+
+uint64_t SIMULATOR::HistoryKey(const STATE& state, int action,
+    observation_t observation) const
+{
+    return 0;
+}
+
+uint64_t SIMULATOR::ObservedHash(const STATE& state) const
+{
+    return 0;
+}
+
+bool SIMULATOR::HasObservationProbability() const
+{
+    return false;
+}
+
+double SIMULATOR::ObservationProbability(const STATE& state, int action,
+    observation_t observation) const
 {
+    return 0;
 }
 
-void SIMULATOR::UpdateAlpha(QNODE& qnode, const STATE& state) const
+void SIMULATOR::SetObservation(STATE& state, int action,
+    observation_t stepObservation, observation_t observation) const
 {
 }
 
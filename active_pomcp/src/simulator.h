@@ -64,6 +64,8 @@ public:
         int TreeLevel;
         int SmartTreeCount;
         double SmartTreeValue;
+        int RuleTreeCount;
+        double RuleTreeValue;
         
         int Level(int phase) const
         {
@@ -133,11 +135,36 @@ public:
     virtual bool LocalMove(STATE& state, const HISTORY& history,
         observation_t stepObs, const STATUS& status) const;
 
+    // Estimate of the discounted return from state onwards, depth steps
+    // below the root. Used where a rollout is truncated; the default
+    // treats the remaining value as zero
+    virtual double EvaluateLeaf(const STATE& state, const HISTORY& history,
+        int depth) const;
+
+    // State of this simulator for a state of the tree simulator, when this
+    // simulator is a cheaper rollout model of it; now owned by caller
+    virtual STATE* ConvertState(const STATE& state) const;
+
+    // Expected immediate reward of action in state, a control variate for
+    // rollout rewards. Only an exact expectation keeps returns unbiased
+    virtual bool HasExpectedReward() const { return false; }
+    virtual double ExpectedReward(const STATE& state, int action) const;
+
     // Use domain knowledge to assign prior value and confidence to actions
     // Should only use fully observable state variables
     void Prior(const STATE* state, const HISTORY& history, VNODE* vnode,
         const STATUS& status) const;
 
+    // Soft prior from the rules learned on the policy: actions the rules
+    // recommend at belief get RuleTreeCount visits of RuleTreeValue on top
+    // of their statistics, so the search can still overrule them
+    bool HasRulePrior() const { return Knowledge.RuleTreeCount > 0; }
+    void RulePrior(const BELIEF_STATE& belief, VNODE* vnode) const;
+
+    // Actions the rules recommend at belief (none by default)
+    virtual void RuleActions(const BELIEF_STATE& belief,
+        std::vector<int>& actions) const;
+
     // Use domain knowledge to select actions stochastically during rollouts
     // Should only use fully observable state variables
     int SelectRandom(const STATE& state, const HISTORY& history,
@@ -151,10 +178,73 @@ public:
     virtual void GeneratePreferred(const STATE& state, const HISTORY& history, 
         std::vector<int>& actions, const STATUS& status) const;
 
+    // The same sets as bitmasks, bit a for action a, for domains with at
+    // most 64 actions. Rollouts then draw actions without building vectors
+    virtual bool HasActionMask() const { return false; }
+    virtual uint64_t LegalMask(const STATE& state, const HISTORY& history,
+        const STATUS& status) const;
+    virtual uint64_t PreferredMask(const STATE& state, const HISTORY& history,
+        const STATUS& status) const;
+    static void MaskToActions(uint64_t mask, std::vector<int>& actions);
+    // Masks match the action vectors and SelectRandom draws the same
+    // action from both, over states visited by random legal steps
+    static void UnitTestActionMask(SIMULATOR& simulator);
+
+    // Macro actions, closed loop policies over the primitive actions that
+    // the tree takes as one edge. Macro m is tree action NumActions + m.
+    // Next primitive action of macro in state, -1 once it is done or when
+    // it does not apply
+    virtual int MacroAction(const STATE& state, int macro) const;
+    // Primitive actions left to the macros when the tree has no others
+    virtual bool MacroCovers(int action) const;
+
     // For explicit POMDP computation only
     virtual bool HasAlpha() const;
-    virtual void AlphaValue(const QNODE& qnode, double& q, int& n) const;
-    virtual void UpdateAlpha(QNODE& qnode, const STATE& state) const;
+    virtual void AlphaValue(const QNODE& qnode, int action, double& q, int& n) const;
+    virtual void UpdateAlpha(QNODE& qnode, int action, const STATE& state) const;
+
+    // Exact belief tracking, for models small or structured enough to
+    // maintain the belief analytically instead of with particles
+    virtual bool HasExactBelief() const;
+    // Initial belief, owned by caller (release with FreeMetainfo)
+    virtual BELIEF_META_INFO* CreateExactBelief() const;
+    // Bayes update after the real action and observation,
+    // return false if the observation has zero probability
+    virtual bool UpdateExactBelief(BELIEF_META_INFO& belief, int action,
+        observation_t observation) const;
+    // Draw a state from an exact belief, now owned by caller
+    virtual STATE* CreateSample(const BELIEF_META_INFO& belief) const;
+
+    // State identity, for storing each distinct particle once
+    virtual bool HasStateHash() const;
+    virtual std::size_t StateHash(const STATE& state) const;
+    virtual bool StateEquals(const STATE& state1, const STATE& state2) const;
+
+    // Observation used to branch the search tree after history, must map
+    // into [0, NumObservations). Equivalent observations may share a
+    // branch; beliefs are still filtered with the real observation.
+    virtual observation_t AbstractObservation(observation_t observation,
+        const HISTORY& history) const;
+
+    // History signatures, for sharing nodes between histories that lead to
+    // the same belief. The signature combines the sum of the step keys with
+    // a hash of the fully observed part of the state, equal histories in
+    // that sense must give the same belief.
+    virtual bool HasHistorySignature() const;
+    // Key of a step, given the state after it
+    virtual uint64_t HistoryKey(const STATE& state, int action,
+        observation_t observation) const;
+    virtual uint64_t ObservedHash(const STATE& state) const;
+
+    // Observation model, for weighting particles in the belief update
+    virtual bool HasObservationProbability() const;
+    // Likelihood of observation after action led to state
+    virtual double ObservationProbability(const STATE& state, int action,
+        observation_t observation) const;
+    // Make observation-dependent fields of a stepped state consistent with
+    // the real observation instead of the one sampled by Step
+    virtual void SetObservation(STATE& state, int action,
+        observation_t stepObservation, observation_t observation) const;
 
     // Textual display
     virtual void DisplayBeliefs(const BELIEF_STATE& beliefState, 
@@ -176,6 +266,7 @@ public:
     void SetKnowledge(const KNOWLEDGE& knowledge) { Knowledge = knowledge; }
     int GetNumActions() const { return NumActions; }
     int GetNumObservations() const { return NumObservations; }
+    int GetNumMacros() const { return NumMacros; }
     bool IsEpisodic() const { return false; }
     double GetDiscount() const { return Discount; }
     double GetRewardRange() const { return RewardRange; }
@@ -210,6 +301,7 @@ public:
 protected:
     int NumActions;
     observation_t NumObservations;
+    int NumMacros = 0;
     bool complex_shield = false;
     double Discount, RewardRange;
     KNOWLEDGE Knowledge;
@@ -33,6 +33,12 @@ bool SIMULATOR_LAZY::LocalMove(STATE& state, const HISTORY& history,
     return true;
 }
 
+double SIMULATOR_LAZY::EvaluateLeaf(const STATE& state, const HISTORY& history,
+    int depth) const
+{
+    return 0;
+}
+
 void SIMULATOR_LAZY::GenerateLegal(const STATE& state, const HISTORY& history, 
     std::vector<int>& actions, const STATUS& status) const
 {
@@ -116,11 +122,11 @@ bool SIMULATOR_LAZY::HasAlpha() const
     return false;
 }
 
-void SIMULATOR_LAZY::AlphaValue(const QNODE& qnode, double& q, int& n) const
+void SIMULATOR_LAZY::AlphaValue(const QNODE& qnode, int action, double& q, int& n) const
 {
 }
 
-void SIMULATOR_LAZY::UpdateAlpha(QNODE& qnode, const STATE& state) const
+void SIMULATOR_LAZY::UpdateAlpha(QNODE& qnode, int action, const STATE& state) const
 {
 }
 
@@ -51,6 +51,12 @@ public:
     virtual bool LocalMove(STATE& state, const HISTORY& history,
         observation_t stepObs, const STATUS& status) const;
 
+    // Estimate of the discounted return from state onwards, depth steps
+    // below the root. Used where a rollout is truncated; the default
+    // treats the remaining value as zero
+    virtual double EvaluateLeaf(const STATE& state, const HISTORY& history,
+        int depth) const;
+
     // Use domain knowledge to assign prior value and confidence to actions
     // Should only use fully observable state variables
     void Prior(const STATE* state, const HISTORY& history, VNODE_LAZY* vnode,
@@ -71,8 +77,8 @@ public:
 
     // For explicit POMDP computation only
     virtual bool HasAlpha() const;
-    virtual void AlphaValue(const QNODE& qnode, double& q, int& n) const;
-    virtual void UpdateAlpha(QNODE& qnode, const STATE& state) const;
+    virtual void AlphaValue(const QNODE& qnode, int action, double& q, int& n) const;
+    virtual void UpdateAlpha(QNODE& qnode, int action, const STATE& state) const;
 
     // Textual display
     virtual void DisplayBeliefs(const BELIEF_STATE& beliefState, 
@@ -21,6 +21,17 @@ void TEST_SIMULATOR::FreeState(STATE* state) const
     delete state;
 }
 
+std::size_t TEST_SIMULATOR::StateHash(const STATE& state) const
+{
+    return safe_cast<const TEST_STATE&>(state).Depth % 3;
+}
+
+bool TEST_SIMULATOR::StateEquals(const STATE& state1, const STATE& state2) const
+{
+    return safe_cast<const TEST_STATE&>(state1).Depth
+        == safe_cast<const TEST_STATE&>(state2).Depth;
+}
+
 bool TEST_SIMULATOR::Step(STATE& state, int action, 
     observation_t& observation, double& reward) const
 {
@@ -28,6 +28,11 @@ public:
     virtual STATE* Copy(const STATE& state) const;
     virtual void FreeState(STATE* state) const;
 
+    // Coarse hash, so that different states also share hash buckets
+    virtual bool HasStateHash() const { return true; }
+    virtual std::size_t StateHash(const STATE& state) const;
+    virtual bool StateEquals(const STATE& state1, const STATE& state2) const;
+
     double OptimalValue() const;
     double MeanValue() const;
 
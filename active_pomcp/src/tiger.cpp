@@ -130,6 +130,35 @@ bool TIGER::LocalMove(STATE& state, const HISTORY& history,
     return true;
 }
 
+std::size_t TIGER::StateHash(const STATE& state) const {
+    const TIGER_STATE& tiger_state = safe_cast<const TIGER_STATE&>(state);
+    return tiger_state.tiger_on_left ? 1 : 0;
+}
+
+bool TIGER::StateEquals(const STATE& state1, const STATE& state2) const {
+    const TIGER_STATE& s1 = safe_cast<const TIGER_STATE&>(state1);
+    const TIGER_STATE& s2 = safe_cast<const TIGER_STATE&>(state2);
+    return s1.tiger_on_left == s2.tiger_on_left &&
+        s1.saved_actions == s2.saved_actions;
+}
+
+double TIGER::ObservationProbability(const STATE& state, int action,
+        observation_t observation) const {
+    const TIGER_STATE& tiger_state = safe_cast<const TIGER_STATE&>(state);
+
+    if (action == A_LISTEN) {
+        if (observation == O_LEFT_ROAR)
+            return tiger_state.tiger_on_left ? 0.85 : 0.15;
+        if (observation == O_RIGHT_ROAR)
+            return tiger_state.tiger_on_left ? 0.15 : 0.85;
+        return 0.0;
+    }
+
+    // opening a door is fully observable
+    bool found_a_tiger = tiger_state.tiger_on_left == (action == A_LEFT_DOOR);
+    return observation == (found_a_tiger ? O_TIGER : O_TREASURE) ? 1.0 : 0.0;
+}
+
 void TIGER::GenerateLegal(const STATE& /*state*/, const HISTORY& /*history*/,
                           std::vector<int>& legal,
                           const STATUS& /*status*/) const {
@@ -149,6 +178,12 @@ void TIGER::GeneratePreferred(const STATE& /*state*/,
     legal.push_back(A_RIGHT_DOOR);
 }
 
+uint64_t TIGER::PreferredMask(const STATE& state, const HISTORY& history,
+                              const STATUS& status) const {
+    // the legal mask already holds all the actions
+    return LegalMask(state, history, status);
+}
+
 void TIGER::DisplayBeliefs(const BELIEF_STATE& beliefState,
                            std::ostream& ostr) const {
     ostr << "TIGER::DisplayBeliefs start" << endl;
@@ -207,9 +242,9 @@ void TIGER::log_beliefs(const BELIEF_STATE& beliefState) const {
         const STATE* s = beliefState.GetSample(i);
         const TIGER_STATE *ts = safe_cast<const TIGER_STATE *>(s);
         if (ts->tiger_on_left)
-            ++left;
+            left += beliefState.GetCount(i);
         else
-            ++right;
+            right += beliefState.GetCount(i);
     }
     XES::logger().start_list("belief");
     XES::logger().add_attribute({"tiger left", left});
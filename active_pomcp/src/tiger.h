@@ -18,11 +18,11 @@ public:
 class TIGER_METAINFO : public BELIEF_META_INFO
 {
 public:
-    virtual void update(STATE *s) {
+    virtual void update(STATE *s, int count) {
         auto tiger_state = safe_cast<TIGER_STATE *>(s);
-        total++;
+        total += count;
         if (tiger_state->tiger_on_left)
-            on_left++;
+            on_left += count;
     }
 
     virtual void clear() {
@@ -64,8 +64,17 @@ public:
         std::vector<int>& legal, const STATUS& status) const;
     void GeneratePreferred(const STATE& state, const HISTORY& history,
         std::vector<int>& legal, const STATUS& status) const;
+    virtual bool HasActionMask() const { return true; }
+    virtual uint64_t PreferredMask(const STATE& state, const HISTORY& history,
+        const STATUS& status) const;
     virtual bool LocalMove(STATE& state, const HISTORY& history,
         int stepObservation, const STATUS& status) const;
+    virtual bool HasStateHash() const { return true; }
+    virtual std::size_t StateHash(const STATE& state) const;
+    virtual bool StateEquals(const STATE& state1, const STATE& state2) const;
+    virtual bool HasObservationProbability() const { return true; }
+    virtual double ObservationProbability(const STATE& state, int action,
+        observation_t observation) const;
 
     virtual void DisplayBeliefs(const BELIEF_STATE& beliefState,
         std::ostream& ostr) const;
@@ -89,6 +98,10 @@ public:
 
     // shielding
     virtual void pre_shield(const BELIEF_STATE &belief, std::vector<int> &legal_actions) const;
+    // the rules decide every action, the shield is the whole rule policy
+    virtual void RuleActions(const BELIEF_STATE &belief, std::vector<int> &actions) const {
+        pre_shield(belief, actions);
+    }
     
 protected:
     std::vector<int> saved_actions;
@@ -113,9 +126,9 @@ private:
 
     // shield
     double tr_open, tr_listen;
-    hellinger_shield<2> open_left_points;
-    hellinger_shield<2> open_right_points;
-    hellinger_shield<2> listen_points;
+    hellinger_tree<2> open_left_points;
+    hellinger_tree<2> open_right_points;
+    hellinger_tree<2> listen_points;
 };
 
 #endif // TIGER_H
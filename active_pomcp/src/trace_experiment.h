@@ -1,6 +1,7 @@
 #pragma once
 
 #include "XES_logger.h"
+#include "budget.h"
 #include "experiment.h"
 #include "mcts.h"
 #include "simulator.h"
@@ -45,6 +46,10 @@ public:
         fixed_seed = s;
     }
 
+    void set_budget(const BUDGET::PARAMS& params) {
+        Budget = BUDGET(params);
+    }
+
     void BuildTrace(trace_t & trace);
 
 private:
@@ -53,6 +58,7 @@ private:
     TRACE_EXPERIMENT::PARAMS& ExpParams;
     MCTS::PARAMS& SearchParams;
     RESULTS Results;
+    BUDGET Budget = BUDGET(BUDGET::PARAMS());
 
     bool use_fixed_seed = false;
     int fixed_seed = -1;
@@ -115,6 +121,7 @@ void TRACE_EXPERIMENT<T>::Run(trace_t &trace)
     if (SearchParams.Verbose >= 1)
         Real.DisplayState(*state, std::cout);
 
+    Budget.StartEpisode(SearchParams.NumSimulations);
     for (t = 0; t < ExpParams.NumSteps; t++)
     {
         if (XES::enabled())
@@ -130,6 +137,17 @@ void TRACE_EXPERIMENT<T>::Run(trace_t &trace)
             Simulator.log_beliefs(mcts.BeliefState());
         }
 
+        if (Budget.Enabled())
+        {
+            int budget = Budget.NextBudget(mcts, Simulator);
+            mcts.SetNumSimulations(budget);
+            if (SearchParams.Verbose >= 1)
+                std::cout << "Step budget = " << budget << " simulations"
+                          << std::endl;
+            if (XES::enabled())
+                XES::logger().add_attributes({{"simulations", budget}});
+        }
+
         // selecte best action using thes simulator
         int action = mcts.SelectAction();
 
@@ -296,6 +314,7 @@ void TRACE_EXPERIMENT<T>::BuildTrace(trace_t &trace)
     SearchParams.MaxAttempts = SearchParams.NumTransforms * ExpParams.TransformAttempts;
 
     Results.Clear();
+    Budget.ClearStatistics();
     MultiRun(trace);
 
     if (XES::enabled()) {
@@ -319,6 +338,8 @@ void TRACE_EXPERIMENT<T>::BuildTrace(trace_t &trace)
          << "Discounted return = " << Results.DiscountedReturn.GetMean()
          << " +- " << Results.DiscountedReturn.GetStdErr() << std::endl
          << "Time = " << Results.Time.GetMean() << std::endl;
+    if (Budget.Enabled())
+        Budget.GetStepBudgets().Print("Simulations per step", std::cout);
 }
 
 //----------------------------------------------------------------------------
@@ -31,6 +31,36 @@ void UnitTest()
     SetFlag(flag, 2);
     SetFlag(flag, 4);
     assert(flag == 21);
+
+    // SelectBit and CountBits against a plain scan of the set bits: full,
+    // single top bit, sparse and random masks
+    std::vector<uint64_t> masks = { 1, 5, 1ULL << 63, ~0ULL, 0xffffffffULL,
+        0x8000000100000001ULL, 0x0102040810204080ULL, 0xdeadbeefcafef00dULL };
+    for (int i = 0; i < 1000; i++)
+    {
+        uint64_t r[3];
+        for (uint64_t& x : r)
+            x = ((uint64_t) rand() << 42) ^ ((uint64_t) rand() << 21) ^ rand();
+        masks.push_back(r[0]);
+        masks.push_back(r[0] & r[1] & r[2]);
+    }
+    for (uint64_t mask : masks)
+    {
+        if (!mask)
+            continue;
+        int k = 0;
+        for (int bit = 0; bit < 64; bit++)
+            if (mask & (1ULL << bit))
+            {
+                assert(SelectBit(mask, k) == bit);
+                k++;
+            }
+        assert(CountBits(mask) == k);
+        (void) k;
+    }
+    assert(SelectBit(~0ULL, 0) == 0);
+    assert(SelectBit(~0ULL, 63) == 63);
+    assert(SelectBit(1ULL << 63, 0) == 63);
 }
 
 }
@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <vector>
+#include <cstdint>
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
@@ -10,6 +11,9 @@
 #include <algorithm>
 #include <random>
 #include <chrono>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 
 #define LargeInteger 1000000
 #define Infinity 1e+10
@@ -49,6 +53,14 @@ inline void RandomSeed(int seed)
     srand(seed);
 }
 
+// Standard normal draw (Box-Muller), u1 is kept away from zero
+inline double RandomNormal()
+{
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (double) rand() / RAND_MAX;
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
 inline bool Bernoulli(double p)
 {
     return rand() < p * RAND_MAX;
@@ -59,6 +71,38 @@ inline bool Near(double x, double y, double tol)
     return fabs(x - y) <= tol;
 }
 
+// Scramble a 64 bit key (one splitmix64 step), for Zobrist style hashing
+inline uint64_t Mix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Number of set bits of an action mask
+inline int CountBits(uint64_t mask)
+{
+    return __builtin_popcountll(mask);
+}
+
+// Index of the k-th (from zero) set bit of mask, which must have more than
+// k bits set
+inline int SelectBit(uint64_t mask, int k)
+{
+    assert(k < CountBits(mask));
+#ifdef __BMI2__
+    return __builtin_ctzll(_pdep_u64(1ULL << k, mask));
+#else
+    for (; k > 0; --k)
+        mask &= mask - 1;
+    return __builtin_ctzll(mask);
+#endif
+}
+
 inline bool CheckFlag(int flags, int bit) { return (flags & (1 << bit)) != 0; }
 
 inline void SetFlag(int& flags, int bit) { flags = (flags | (1 << bit)); }
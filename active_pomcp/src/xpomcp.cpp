@@ -280,6 +280,7 @@ int main(int argc, char *argv[]) {
 
     MCTS::PARAMS searchParams;
     TRACE_EXPERIMENT<ROCKSAMPLE_TRACE>::PARAMS expParams;
+    BUDGET::PARAMS budgetParams;
     SIMULATOR::KNOWLEDGE knowledge;
     std::string outputfile, policy, initfile;
     int size, number;
@@ -349,6 +350,17 @@ int main(int argc, char *argv[]) {
         ("seed", value<int>(&random_seed),
          "set random seed (-1 to initialize using time, >= 0 to use a fixed "
          "integer as the initial seed)")
+        ("budget", value<int>(&budgetParams.Mode),
+         "Episode simulation budget (0=Uniform, 1=Belief entropy, 2=Root "
+         "value gap)")
+        ("budgetsteps", value<int>(&budgetParams.EpisodeSteps),
+         "Expected decisions per episode")
+        ("budgetmin", value<double>(&budgetParams.MinScale),
+         "Smallest step budget, as a fraction of the simulations per "
+         "decision; an easy decision also gets this fraction of the even "
+         "share")
+        ("budgetmax", value<double>(&budgetParams.MaxScale),
+         "Largest step budget, as a multiple of the even share")
         ("setW", value<double>(&W), "Fix the reward range (testing purpouse)")
         ("initfile", value<std::string>(&initfile), "use json file to initialize")
         ("xes", value<bool>(&xes_log)->default_value(true), "Enable XES log");
@@ -384,6 +396,7 @@ int main(int argc, char *argv[]) {
 
     TRACE_EXPERIMENT<ROCKSAMPLE_TRACE> experiment(*real, *simulator, expParams,
                                                   searchParams);
+    experiment.set_budget(budgetParams);
 
     if (vm.count("seed") != 0) {
         experiment.set_fixed_seed(random_seed);
@@ -484,6 +497,7 @@ int main(int argc, char *argv[]) {
 
         TRACE_EXPERIMENT<ROCKSAMPLE_TRACE> experiment(*real2, *simulator2,
                                                       expParams, searchParams);
+        experiment.set_budget(budgetParams);
 
         if (vm.count("seed") != 0) {
             experiment.set_fixed_seed(++random_seed);